@@ -0,0 +1,187 @@
+/*******************************************************************************
+	ads1672_bench.c: Measure the CPU cost of reading ADS1672 samples.
+
+	Copyright (C) 2013 Paul Barker, Loughborough University
+
+	This program is free software; you can redistribute it and/or modify
+	it under the terms of the GNU General Public License as published by
+	the Free Software Foundation; either version 2 of the License, or
+	(at your option) any later version.
+
+	This program is distributed in the hope that it will be useful,
+	but WITHOUT ANY WARRANTY; without even the implied warranty of
+	MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+	GNU General Public License for more details.
+
+	You should have received a copy of the GNU General Public License
+	along with this program; if not, write to the Free Software
+	Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+*******************************************************************************/
+
+/* The converter sets the rate at which samples arrive, so the throughput of
+ * read() itself is measured by the CPU time it takes rather than the wall
+ * clock time. This reads a number of periods and discards them, then prints
+ * the user and system time used per MiB read. Run it once with the module
+ * loaded with cached_buffer=0 and once with cached_buffer=1 to compare the two
+ * kinds of buffer.
+ *
+ * Usage: ads1672_bench [device [periods]]
+ */
+
+#include <ads1672.h>
+#include <fcntl.h>
+#include <malloc.h>
+#include <stdbool.h>
+#include <stddef.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/resource.h>
+#include <sys/time.h>
+#include <unistd.h>
+
+static int fh_in = -1;
+static ads1672_sample_t * buffer = NULL;
+static size_t buffer_size = 0;
+static bool ads1672_running = false;
+static unsigned int max_periods = 256;
+
+void cleanup(void)
+{
+	/* If the device is running, try to stop it. */
+	if (ads1672_running) {
+		ads1672_ioctl_stop(fh_in);
+		ads1672_running = false;
+	}
+
+	/* If the device is open, try to reset the gpio pins to safe states. */
+	if (fh_in >= 0) {
+		ads1672_ioctl_gpio_select_set(fh_in, 1);
+		ads1672_ioctl_gpio_start_set(fh_in, 0);
+		close(fh_in);
+		fh_in = -1;
+	}
+
+	if (buffer) {
+		free(buffer);
+		buffer = NULL;
+	}
+}
+
+/* Simple error handler: Print message, cleanup and abort. */
+void error(const char * failing_function)
+{
+	char s[256];
+	snprintf(s, 256, "ads1672_bench: %s failed", failing_function);
+	perror(s);
+	cleanup();
+	abort();
+}
+
+void init(const char * device)
+{
+	int r;
+	struct ads1672_geometry geometry;
+
+	fh_in = open(device, O_RDONLY);
+	if (fh_in < 0)
+		error("init: open");
+
+	r = ads1672_ioctl_gpio_select_set(fh_in, 0);
+	if (r < 0)
+		error("init: ads1672_ioctl_gpio_select_set");
+
+	r = ads1672_ioctl_gpio_start_set(fh_in, 0);
+	if (r < 0)
+		error("init: ads1672_ioctl_gpio_start_set");
+
+	/* Read a period at a time, as ads1672_dump does. */
+	r = ads1672_ioctl_get_geometry(fh_in, &geometry);
+	if (r < 0)
+		error("init: ads1672_ioctl_get_geometry");
+
+	buffer_size = geometry.period_length * sizeof(ads1672_sample_t);
+	buffer = (ads1672_sample_t *) malloc(buffer_size);
+	if (!buffer)
+		error("init: malloc");
+}
+
+void start(void)
+{
+	int r;
+
+	r = ads1672_ioctl_start(fh_in);
+	if (r < 0)
+		error("start: ads1672_ioctl_start");
+	ads1672_running = true;
+
+	r = ads1672_ioctl_gpio_start_set(fh_in, 1);
+	if (r < 0)
+		error("start: ads1672_ioctl_gpio_start_set");
+}
+
+void stop(void)
+{
+	int r;
+
+	r = ads1672_ioctl_gpio_start_set(fh_in, 0);
+	if (r < 0)
+		error("stop: ads1672_ioctl_gpio_start_set");
+
+	ads1672_running = false;
+
+	r = ads1672_ioctl_stop(fh_in);
+	if (r < 0)
+		error("stop: ads1672_ioctl_stop");
+}
+
+static double seconds(const struct timeval * tv)
+{
+	return tv->tv_sec + tv->tv_usec / 1e6;
+}
+
+void run(void)
+{
+	struct rusage before, after;
+	unsigned int count;
+	double bytes = 0, user, sys;
+	ssize_t r;
+
+	if (getrusage(RUSAGE_SELF, &before) < 0)
+		error("run: getrusage");
+
+	for (count = 0; count < max_periods; count++) {
+		r = read(fh_in, buffer, buffer_size);
+		if (r < 0)
+			error("run: read");
+		bytes += r;
+	}
+
+	if (getrusage(RUSAGE_SELF, &after) < 0)
+		error("run: getrusage");
+
+	user = seconds(&after.ru_utime) - seconds(&before.ru_utime);
+	sys = seconds(&after.ru_stime) - seconds(&before.ru_stime);
+
+	bytes /= 1024 * 1024;
+	printf("Read %.1f MiB: user %.3f s, system %.3f s, "
+			"%.2f ms CPU per MiB\n", bytes, user, sys,
+			bytes > 0 ? (user + sys) * 1000 / bytes : 0);
+}
+
+int main(int argc, char * argv[])
+{
+	const char * device = "/dev/ads1672.0";
+
+	if (argc > 1)
+		device = argv[1];
+	if (argc > 2)
+		max_periods = strtoul(argv[2], NULL, 0);
+
+	init(device);
+	start();
+	run();
+	stop();
+	cleanup();
+
+	return 0;
+}
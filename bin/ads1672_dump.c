@@ -102,10 +102,11 @@ void init(void)
 {
 	mode_t m;
 	int r;
+	struct ads1672_geometry geometry;
 	const char * outfile = "dump.dat";	/* TODO: Make configurable. */
 	
 	/* Open input file. */
-	fh_in = open("/dev/ads1672", O_RDONLY);
+	fh_in = open("/dev/ads1672.0", O_RDONLY);
 	if (fh_in < 0)
 		error("init: open");
 
@@ -125,10 +126,14 @@ void init(void)
 	if (fh_out < 0)
 		error("init: creat");
 
-	/* Allocate a buffer for ADS1672_PERIOD_LENGTH samples so that reads
-	 * line up with the periods of the underlying driver.
+	/* Allocate a buffer for one period of samples so that reads line up
+	 * with the periods of the underlying driver.
 	 */
-	buffer_size = ADS1672_PERIOD_LENGTH * sizeof(ads1672_sample_t);
+	r = ads1672_ioctl_get_geometry(fh_in, &geometry);
+	if (r < 0)
+		error("init: ads1672_ioctl_get_geometry");
+
+	buffer_size = geometry.period_length * sizeof(ads1672_sample_t);
 	buffer = (ads1672_sample_t *) malloc(buffer_size);
 	if (!buffer)
 		error("init: malloc");
@@ -25,12 +25,13 @@ d := $(dir)
 
 # Targets and intermediates in this directory
 OBJS_ads1672_dump := $(d)/ads1672_dump.o
+OBJS_ads1672_bench := $(d)/ads1672_bench.o
 
-OBJS_$(d) := $(OBJS_ads1672_dump)
+OBJS_$(d) := $(OBJS_ads1672_dump) $(OBJS_ads1672_bench)
 
 DEPS_$(d) := $(OBJS_$(d):%.o=%.d)
 
-TGTS_$(d) := $(d)/ads1672_dump
+TGTS_$(d) := $(d)/ads1672_dump $(d)/ads1672_bench
 
 TARGETS_BIN += $(TGTS_$(d))
 
@@ -42,6 +43,7 @@ INSTALL_DEPS += install-$(d)
 $(OBJS_$(d)): CFLAGS_TGT := -I$(SRCDIR)/$(d)
 
 $(d)/ads1672_dump: $(OBJS_ads1672_dump)
+$(d)/ads1672_bench: $(OBJS_ads1672_bench)
 
 .PHONY: install-$(d)
 install-$(d): $(TGTS_$(d))
@@ -26,14 +26,231 @@
 
 #include <linux/ioctl.h>
 
-/* We need to take the appropriate definition of struct timespec depending on
- * whether this header is being used in kernel space or in user space.
+/* Times are passed as struct __kernel_timespec, which has a 64 bit tv_sec on
+ * every architecture, so the layout of the structures below is the same for
+ * 32 and 64 bit user space. It converts to and from struct timespec by member.
  */
-#ifdef __KERNEL__
-#include <linux/time.h>
-#else
-#include <time.h>
-#endif
+#include <linux/time_types.h>
+
+/**
+ * Geometry of the DMA buffer.
+ */
+struct ads1672_geometry {
+	/**
+	 * Length of each period in samples.
+	 */
+	unsigned int			period_length;
+
+	/**
+	 * Number of periods in the DMA buffer.
+	 */
+	unsigned int			nr_periods;
+};
+
+/**
+ * Read position of an open file, as returned by ads1672_ioctl_wait_period().
+ */
+struct ads1672_position {
+	/**
+	 * Condition code of the current period, one of ::ADS1672_COND.
+	 */
+	int				cond;
+
+	/**
+	 * Sequence number of the current period.
+	 */
+	unsigned int			seq;
+
+	/**
+	 * Index of the current period in the sample buffer.
+	 */
+	unsigned int			period;
+
+	/**
+	 * Offset of the next sample to be read within the current period.
+	 */
+	unsigned int			offset;
+};
+
+/**
+ * Request for the time of a single sample.
+ */
+struct ads1672_sample_time {
+	/**
+	 * Sample index, given by seq * period_length + offset where seq is the
+	 * sequence number of the period containing the sample.
+	 */
+	unsigned long long		index;
+
+	/**
+	 * CLOCK_MONOTONIC_RAW time of the sample, filled in by the driver.
+	 */
+	struct __kernel_timespec	ts;
+};
+
+/**
+ * Status of a single period in the DMA buffer.
+ */
+struct ads1672_period_status {
+	/**
+	 * Condition code, one of ::ADS1672_COND.
+	 */
+	int				cond;
+
+	/**
+	 * Number of valid samples.
+	 */
+	int				nr_samples;
+
+	/**
+	 * Sequence number of the period, counting periods completed since the
+	 * buffer was allocated.
+	 */
+	unsigned int			seq;
+
+	/**
+	 * Number of samples lost to a DMA error in this period, counted from
+	 * the start of the period until the transfer was restarted at the
+	 * start of the next one.
+	 */
+	unsigned int			nr_lost;
+
+	/**
+	 * CLOCK_MONOTONIC_RAW time of the first valid sample in the period.
+	 */
+	struct __kernel_timespec	ts;
+};
+
+/**
+ * A buffer in user space into which the DMA may write samples directly, as
+ * used by ads1672_ioctl_queue_buffer() and ads1672_ioctl_dequeue_buffer().
+ *
+ * As for struct ads1672_batch, the address is carried in a 64 bit field, set
+ * with a (uintptr_t) cast, so that the layout is the same for 32 and 64 bit
+ * user space.
+ */
+struct ads1672_user_buffer {
+	/**
+	 * Start of the buffer, which must be page aligned and physically
+	 * contiguous, for example a huge page.
+	 */
+	unsigned long long		addr;
+
+	/**
+	 * Length of the buffer in bytes, which must be exactly one period.
+	 */
+	unsigned int			length;
+
+	/**
+	 * Index of the buffer, filled in by the driver.
+	 */
+	unsigned int			index;
+
+	/**
+	 * Status of the samples in the buffer, filled in by
+	 * ads1672_ioctl_dequeue_buffer(). The sequence number counts periods
+	 * captured since the device was started, so a gap shows periods which
+	 * were discarded for lack of a queued buffer.
+	 */
+	struct ads1672_period_status	status;
+};
+
+/**
+ * Request to read several whole periods at once, as used by
+ * ads1672_ioctl_read_periods().
+ *
+ * The pointers are carried in 64 bit fields, set with (uintptr_t) casts, so
+ * that the layout is the same for 32 and 64 bit user space.
+ */
+struct ads1672_batch {
+	/**
+	 * Address of an int buffer for the samples, with room for nr_periods
+	 * periods. The samples of the i'th period returned start at
+	 * data[i * period_length] and are always in the native
+	 * ads1672_sample_t format.
+	 */
+	unsigned long long		data;
+
+	/**
+	 * Address of an array of nr_periods struct ads1672_period_status
+	 * records, filled in with the status of each period returned.
+	 */
+	unsigned long long		status;
+
+	/**
+	 * Maximum number of periods to read on entry, number of periods
+	 * actually read on return.
+	 */
+	unsigned int			nr_periods;
+
+	/**
+	 * Must be zero.
+	 */
+	unsigned int			reserved;
+};
+
+/**
+ * Result of starting a capture with ads1672_ioctl_trigger(). All times are
+ * CLOCK_MONOTONIC_RAW, as for the period timestamps.
+ */
+struct ads1672_trigger {
+	/**
+	 * Sequence number of the first period of the capture. Sample k of the
+	 * capture is sample k % period_length of period seq + k / period_length.
+	 */
+	unsigned int			seq;
+
+	/**
+	 * Width in nanoseconds of the window in which START was raised, the
+	 * uncertainty of start.
+	 */
+	unsigned int			window;
+
+	/**
+	 * Time at which START was raised, the middle of the window.
+	 */
+	struct __kernel_timespec	start;
+
+	/**
+	 * Time of the first sample, which follows start by the start_delay
+	 * module parameter. Sample k of the capture was taken k sample periods
+	 * after this at the nominal sample rate.
+	 */
+	struct __kernel_timespec	first;
+};
+
+/**
+ * Request to start a capture at a given time, as used by
+ * ads1672_ioctl_trigger_at().
+ */
+struct ads1672_trigger_at {
+	/**
+	 * Clock of when and actual, CLOCK_REALTIME or CLOCK_TAI.
+	 */
+	int				clock;
+
+	/**
+	 * Absolute time at which to raise START.
+	 */
+	struct __kernel_timespec	when;
+
+	/**
+	 * Time at which START was actually raised, filled in by the driver.
+	 */
+	struct __kernel_timespec	actual;
+
+	/**
+	 * Error of actual in nanoseconds, positive if late, filled in by the
+	 * driver.
+	 */
+	long long			error;
+
+	/**
+	 * The capture started, filled in by the driver as for
+	 * ads1672_ioctl_trigger().
+	 */
+	struct ads1672_trigger		trigger;
+};
 
 enum ADS1672_IOCTL {
 	ADS1672_IOCTL_MAGIC = '=',
@@ -45,8 +262,26 @@ enum ADS1672_IOCTL {
 	ADS1672_IOCTL_GPIO_SELECT_SET = _IOW(ADS1672_IOCTL_MAGIC, 5, int),
 	ADS1672_IOCTL_GPIO_SELECT_GET = _IOR(ADS1672_IOCTL_MAGIC, 6, int),
 	ADS1672_IOCTL_CLEAR_CONDITION = _IO(ADS1672_IOCTL_MAGIC, 7),
-	ADS1672_IOCTL_GET_TIMESPEC = _IOR(ADS1672_IOCTL_MAGIC, 8, struct timespec),
+	ADS1672_IOCTL_GET_TIMESPEC = _IOR(ADS1672_IOCTL_MAGIC, 8, struct __kernel_timespec),
 	ADS1672_IOCTL_GET_CONDITION = _IOR(ADS1672_IOCTL_MAGIC, 9, int),
+	ADS1672_IOCTL_WAIT_PERIOD = _IOR(ADS1672_IOCTL_MAGIC, 10, struct ads1672_position),
+	ADS1672_IOCTL_ADVANCE = _IO(ADS1672_IOCTL_MAGIC, 11),
+	ADS1672_IOCTL_GET_GEOMETRY = _IOR(ADS1672_IOCTL_MAGIC, 12, struct ads1672_geometry),
+	ADS1672_IOCTL_SET_GEOMETRY = _IOW(ADS1672_IOCTL_MAGIC, 13, struct ads1672_geometry),
+	ADS1672_IOCTL_GET_SAMPLE_TIME = _IOWR(ADS1672_IOCTL_MAGIC, 14, struct ads1672_sample_time),
+	ADS1672_IOCTL_SET_FORMAT = _IOW(ADS1672_IOCTL_MAGIC, 15, int),
+	ADS1672_IOCTL_GET_FORMAT = _IOR(ADS1672_IOCTL_MAGIC, 16, int),
+	ADS1672_IOCTL_READ_PERIODS = _IOWR(ADS1672_IOCTL_MAGIC, 17, struct ads1672_batch),
+	ADS1672_IOCTL_QUEUE_BUFFER = _IOWR(ADS1672_IOCTL_MAGIC, 18, struct ads1672_user_buffer),
+	ADS1672_IOCTL_DEQUEUE_BUFFER = _IOR(ADS1672_IOCTL_MAGIC, 19, struct ads1672_user_buffer),
+	ADS1672_IOCTL_RELEASE_BUFFERS = _IO(ADS1672_IOCTL_MAGIC, 20),
+	ADS1672_IOCTL_SET_AVAIL_MIN = _IOW(ADS1672_IOCTL_MAGIC, 21, unsigned int),
+	ADS1672_IOCTL_GET_AVAIL_MIN = _IOR(ADS1672_IOCTL_MAGIC, 22, unsigned int),
+	ADS1672_IOCTL_SET_LIVE = _IOW(ADS1672_IOCTL_MAGIC, 23, int),
+	ADS1672_IOCTL_GET_LIVE = _IOR(ADS1672_IOCTL_MAGIC, 24, int),
+	ADS1672_IOCTL_SET_GANG = _IOW(ADS1672_IOCTL_MAGIC, 25, unsigned int),
+	ADS1672_IOCTL_TRIGGER = _IOR(ADS1672_IOCTL_MAGIC, 26, struct ads1672_trigger),
+	ADS1672_IOCTL_TRIGGER_AT = _IOWR(ADS1672_IOCTL_MAGIC, 27, struct ads1672_trigger_at),
 };
 
 #ifndef __KERNEL__
@@ -92,10 +327,213 @@ static inline int ads1672_ioctl_get_condition(int fh, int * condition)
 	return ioctl(fh, ADS1672_IOCTL_GET_CONDITION, condition);
 }
 
-static inline int ads1672_ioctl_get_timespec(int fh, struct timespec * ts)
+static inline int ads1672_ioctl_get_timespec(int fh,
+		struct __kernel_timespec * ts)
 {
 	return ioctl(fh, ADS1672_IOCTL_GET_TIMESPEC, ts);
 }
+
+static inline int ads1672_ioctl_wait_period(int fh,
+		struct ads1672_position * pos)
+{
+	return ioctl(fh, ADS1672_IOCTL_WAIT_PERIOD, pos);
+}
+
+static inline int ads1672_ioctl_advance(int fh)
+{
+	return ioctl(fh, ADS1672_IOCTL_ADVANCE);
+}
+
+static inline int ads1672_ioctl_get_sample_time(int fh,
+		struct ads1672_sample_time * st)
+{
+	return ioctl(fh, ADS1672_IOCTL_GET_SAMPLE_TIME, st);
+}
+
+static inline int ads1672_ioctl_get_geometry(int fh,
+		struct ads1672_geometry * geometry)
+{
+	return ioctl(fh, ADS1672_IOCTL_GET_GEOMETRY, geometry);
+}
+
+static inline int ads1672_ioctl_set_geometry(int fh,
+		const struct ads1672_geometry * geometry)
+{
+	return ioctl(fh, ADS1672_IOCTL_SET_GEOMETRY, geometry);
+}
+
+static inline int ads1672_ioctl_set_format(int fh, int format)
+{
+	return ioctl(fh, ADS1672_IOCTL_SET_FORMAT, &format);
+}
+
+static inline int ads1672_ioctl_get_format(int fh, int * format)
+{
+	return ioctl(fh, ADS1672_IOCTL_GET_FORMAT, format);
+}
+
+/**
+ * Read every complete period available, up to batch->nr_periods, together with
+ * the status of each, waiting for the first one unless the file is
+ * non-blocking.
+ *
+ * Each status record gives the condition, number of valid samples, sequence
+ * number and time of the first sample returned for that period. Periods with a
+ * condition other than ADS1672_COND_OK are returned rather than failing the
+ * call, and the condition is cleared, so ads1672_ioctl_clear_condition() is not
+ * needed. If the reader has fallen behind, the first period returned after the
+ * gap has condition ADS1672_COND_OVERRUN. If the read cursor is part way
+ * through a period, only the remainder of that period is returned.
+ *
+ * If a buffer faults after some periods have been copied, those periods are
+ * returned rather than an error and the faulting period is left to be read
+ * again.
+ */
+static inline int ads1672_ioctl_read_periods(int fh,
+		struct ads1672_batch * batch)
+{
+	return ioctl(fh, ADS1672_IOCTL_READ_PERIODS, batch);
+}
+
+/**
+ * Queue a user buffer for the DMA to fill.
+ *
+ * The first time a buffer is queued it is pinned in memory and registered with
+ * the calling file, which then owns the user buffers until it releases them or
+ * is closed. While any user buffers are registered, ads1672_ioctl_start()
+ * captures directly into them in the order they are queued instead of into the
+ * kernel buffer, so read() and the mmap() interface see no data. If the queue
+ * runs dry, samples are discarded until another buffer is queued and the next
+ * buffer filled has condition ADS1672_COND_OVERRUN.
+ *
+ * A buffer which has been dequeued is queued again by passing the same addr.
+ */
+static inline int ads1672_ioctl_queue_buffer(int fh,
+		struct ads1672_user_buffer * buf)
+{
+	return ioctl(fh, ADS1672_IOCTL_QUEUE_BUFFER, buf);
+}
+
+/**
+ * Take the oldest filled user buffer, waiting for one unless the file is
+ * non-blocking. poll() reports POLLIN when a filled buffer is ready.
+ */
+static inline int ads1672_ioctl_dequeue_buffer(int fh,
+		struct ads1672_user_buffer * buf)
+{
+	return ioctl(fh, ADS1672_IOCTL_DEQUEUE_BUFFER, buf);
+}
+
+/**
+ * Unpin and forget all user buffers, returning the device to capturing into
+ * the kernel buffer. The device must be stopped.
+ */
+static inline int ads1672_ioctl_release_buffers(int fh)
+{
+	return ioctl(fh, ADS1672_IOCTL_RELEASE_BUFFERS);
+}
+
+/**
+ * Set the number of samples which must be available before a blocking read,
+ * ads1672_ioctl_wait_period() or poll() on this file wakes up. The default is
+ * 1, so any complete period wakes the reader.
+ *
+ * Latency is set by the period length, see ads1672_ioctl_set_geometry(), as
+ * the DMA interrupts once per period. For low latency use a short period, and
+ * let bulk readers set a high watermark so that they are only woken when a
+ * useful amount of data has built up. A reader is also woken early if a period
+ * it has yet to read had an error or if the DMA is about to overrun it.
+ */
+static inline int ads1672_ioctl_set_avail_min(int fh, unsigned int avail_min)
+{
+	return ioctl(fh, ADS1672_IOCTL_SET_AVAIL_MIN, &avail_min);
+}
+
+static inline int ads1672_ioctl_get_avail_min(int fh, unsigned int * avail_min)
+{
+	return ioctl(fh, ADS1672_IOCTL_GET_AVAIL_MIN, avail_min);
+}
+
+/**
+ * Enable or disable live mode for this file. In live mode read() and poll()
+ * also see the samples which the DMA has already written into the period
+ * being filled, found by reading back the DMA destination position, so the
+ * latency no longer depends on the period length. Nothing is known about the
+ * condition of those samples until their period completes. The DMA only
+ * interrupts at the end of each period, so a blocking read in live mode
+ * checks for new samples once per kernel tick.
+ */
+static inline int ads1672_ioctl_set_live(int fh, int live)
+{
+	return ioctl(fh, ADS1672_IOCTL_SET_LIVE, &live);
+}
+
+static inline int ads1672_ioctl_get_live(int fh, int * live)
+{
+	return ioctl(fh, ADS1672_IOCTL_GET_LIVE, live);
+}
+
+/**
+ * Gang this file's device with others so that they capture on the same sample
+ * clock edge and are read as one stream. mask has bit N set for /dev/ads1672.N
+ * and must include this file's device, or be 0 to leave the gang. The devices
+ * must be stopped and have the same period length, and must share a sample
+ * clock.
+ *
+ * While ganged, ads1672_ioctl_start() arms the DMA of every device with their
+ * START pins held low and then raises them together, and
+ * ads1672_ioctl_stop() stops them all. read() returns interleaved frames of one
+ * sample from each device in order of device number, in this file's format.
+ * Periods are matched by their sequence number counted from the start, and
+ * their timestamps are checked to agree. If a device drops a period or falls
+ * out of step, read() fails with EIO and ads1672_ioctl_get_condition() reports
+ * the condition; ads1672_ioctl_clear_condition() then realigns the devices at
+ * the next period which all of them have.
+ *
+ * Other ways of consuming samples, such as splice(),
+ * ads1672_ioctl_read_periods() and ads1672_ioctl_advance(), are refused on a
+ * ganged file.
+ */
+static inline int ads1672_ioctl_set_gang(int fh, unsigned int mask)
+{
+	return ioctl(fh, ADS1672_IOCTL_SET_GANG, &mask);
+}
+
+/**
+ * Start a capture in one step with a known time for every sample. The device
+ * must be stopped and must not have user buffers registered.
+ *
+ * START is held low while the DMA and McBSP are armed, then raised with
+ * interrupts disabled between two reads of the clock, so the time of the edge
+ * is known however long arming took. Anything left unread by this file is
+ * discarded, so its next read() returns the first sample of the capture. The
+ * result is also published in the status area, see struct ads1672_mmap_status.
+ */
+static inline int ads1672_ioctl_trigger(int fh, struct ads1672_trigger * t)
+{
+	return ioctl(fh, ADS1672_IOCTL_TRIGGER, t);
+}
+
+/**
+ * As ads1672_ioctl_trigger(), but raise START at the absolute time t->when on
+ * t->clock rather than at once, for starting captures on several systems with
+ * synchronised clocks together.
+ *
+ * The transfer is armed straight away and START is raised from a high
+ * resolution timer, so no process needs to be scheduled at the start time.
+ * The call blocks until START has been raised. If it is interrupted by a
+ * signal first, the transfer is disarmed and the call fails with EINTR. A
+ * time already past starts the capture at once, with a positive error.
+ *
+ * The trigger_lead module parameter trades CPU time for accuracy: the timer
+ * fires that many nanoseconds early, up to 100 microseconds, and the rest of
+ * the wait is spent polling the clock with interrupts disabled. If the clock is
+ * stepped back during the poll, START is raised anyway after twice the lead.
+ */
+static inline int ads1672_ioctl_trigger_at(int fh, struct ads1672_trigger_at * t)
+{
+	return ioctl(fh, ADS1672_IOCTL_TRIGGER_AT, t);
+}
 #endif
 
 /**
@@ -103,9 +541,42 @@ static inline int ads1672_ioctl_get_timespec(int fh, struct timespec * ts)
  */
 typedef int ads1672_sample_t;
 
+/**
+ * Formats in which read() may return samples, selected per open file with
+ * ads1672_ioctl_set_format().
+ *
+ * The ADS1672 produces 24 bit samples, so the top byte of each native sample
+ * is only sign extension. The packed formats trade that byte (and for
+ * ADS1672_FORMAT_S16 the lowest 8 bits of resolution) for memory bandwidth.
+ * The mmap() interface always exposes native samples.
+ */
+enum ADS1672_FORMAT {
+	/**
+	* Native ads1672_sample_t, 4 bytes per sample. This is the default.
+	*/
+	ADS1672_FORMAT_S32 = 0,
+
+	/**
+	* Signed 24 bit little-endian, 3 bytes per sample with no padding.
+	*/
+	ADS1672_FORMAT_S24_PACKED = 1,
+
+	/**
+	* Top 16 bits of each sample, signed little-endian, 2 bytes per sample.
+	*/
+	ADS1672_FORMAT_S16 = 2
+};
+
+/**
+ * Default buffer geometry.
+ *
+ * These may be overridden by the period_length and nr_periods module
+ * parameters or by ads1672_ioctl_set_geometry() while the device is stopped, so
+ * user space should query the live values with ads1672_ioctl_get_geometry().
+ */
 enum {
 	/**
-	* Length of each period in samples.
+	* Default length of each period in samples.
 	*
 	* This is currently 64 ksamples (256 kB) for a period completion
 	* approximately every 100 ms.
@@ -113,10 +584,16 @@ enum {
 	ADS1672_PERIOD_LENGTH = 64 * 1024,
 
 	/**
-	* Number of periods in the DMA buffer. This is currently 4, giving 256
-	* ksamples and a memory usage of 1 MB.
+	* Default number of periods in the DMA buffer. This is currently 4,
+	* giving 256 ksamples and a memory usage of 1 MB.
+	*/
+	ADS1672_NR_PERIODS = 4,
+
+	/**
+	* Nominal sample rate in Hz, which may be overridden by the sample_rate
+	* module parameter. Only used for timestamping.
 	*/
-	ADS1672_NR_PERIODS = 4
+	ADS1672_SAMPLE_RATE = 625000
 };
 
 /**
@@ -149,7 +626,9 @@ enum ADS1672_COND {
 	*
 	* Samples may have been lost in transit between the McBSP and main
 	* memory or the FIFO on the McBSP may overrun before the DMA system is
-	* running again.
+	* running again. The driver restarts the transfer at the start of the
+	* next period and reports the number of samples lost in the nr_lost
+	* field of the period's status.
 	*/
 	ADS1672_COND_DMA_ERROR = -2,
 
@@ -160,7 +639,8 @@ enum ADS1672_COND {
 	* due to the start or power pins being taken low. This condition can be
 	* cleared but no data will be available. A further read may cause the
 	* user process to sleep indefinitely waiting for new data which will
-	* never arrive.
+	* never arrive, unless the device was opened with O_NONBLOCK or the
+	* read_timeout module parameter is set.
 	*/
 	ADS1672_COND_STOP = -3,
 
@@ -181,7 +661,106 @@ enum ADS1672_COND {
 	* code and attempting to read data has undefined results and may crash
 	* the system.
 	*/
-	ADS1672_COND_INVALID = -5
+	ADS1672_COND_INVALID = -5,
+
+	/**
+	* Ganged devices out of step.
+	*
+	* A device read as part of a gang did not have the period expected of
+	* it, for example after an overrun or DMA error on one device only, or
+	* its period started at a different time to the others. Clearing the
+	* condition realigns the gang at the next period all devices have.
+	*/
+	ADS1672_COND_MISALIGNED = -6,
+
+	/**
+	* Status of the period lost.
+	*
+	* The driver fell so far behind the DMA that the record of how this
+	* period completed was overwritten before it was handled. The DMA
+	* still filled the period and its samples are returned once the
+	* condition is cleared, but its time is estimated from the period
+	* before and an error during the transfer would not have been seen.
+	*/
+	ADS1672_COND_STATUS_LOST = -7
+};
+
+/**
+ * Layout of the status area which may be mapped read-only into a process at
+ * offset ::ADS1672_MMAP_STATUS_OFFSET.
+ *
+ * The driver updates these fields as periods complete, so a process reading
+ * them should treat them as volatile. Each open file has its own read cursor,
+ * which is not part of the status area. A typical zero-copy consumer maps the
+ * sample buffer and the status area, then loops calling
+ * ads1672_ioctl_wait_period(), processing the samples of the period it returns
+ * in place and calling ads1672_ioctl_advance() when done with them.
+ *
+ * Sequence numbers are free-running and wrap, so compare them by unsigned
+ * subtraction. write_seq is only incremented after the status record of the
+ * completed period has been written, so read write_seq with acquire semantics
+ * before reading any records. The samples of the period with sequence number
+ * seq are intact for as long as write_seq - seq < nr_periods; a consumer
+ * working in place should check this again once it has finished with them.
+ */
+struct ads1672_mmap_status {
+	/**
+	 * Index of the period currently being filled by DMA.
+	 */
+	unsigned int			write_period;
+
+	/**
+	 * Sequence number of the period currently being filled by DMA, which is
+	 * also the number of periods completed.
+	 */
+	unsigned int			write_seq;
+
+	/**
+	 * Number of periods in the sample buffer.
+	 */
+	unsigned int			nr_periods;
+
+	/**
+	 * Length of each period in samples.
+	 */
+	unsigned int			period_length;
+
+	/**
+	 * Sequence number of the first period of the current capture, set when
+	 * the capture is started.
+	 */
+	unsigned int			start_seq;
+
+	/**
+	 * Time of the first sample of the current capture if it was started by
+	 * ads1672_ioctl_trigger(), otherwise zero. Both fields are written
+	 * before the first period of the capture completes, so they may be
+	 * read once write_seq has moved past start_seq.
+	 */
+	struct __kernel_timespec	start_ts;
+
+	/**
+	 * Status of each period, nr_periods entries long.
+	 */
+	struct ads1672_period_status	periods[0];
+};
+
+/**
+ * Offsets which may be passed to mmap() on an ads1672 device.
+ */
+enum ADS1672_MMAP {
+	/**
+	* The sample buffer itself, nr_periods * period_length samples long.
+	* Mapping it fails with EINVAL if the driver has split it into chunks
+	* of coherent memory, see the chunk_size and cached_buffer module
+	* parameters.
+	*/
+	ADS1672_MMAP_DATA_OFFSET = 0,
+
+	/**
+	* The status area, described by struct ads1672_mmap_status.
+	*/
+	ADS1672_MMAP_STATUS_OFFSET = 0x40000000
 };
 
 /**
@@ -22,88 +22,788 @@
  */
 
 #include <ads1672.h>
+#include <linux/atomic.h>
 #include <linux/dma-mapping.h>
-#include <linux/completion.h>
+#include <linux/jiffies.h>
+#include <linux/list.h>
+#include <linux/math64.h>
+#include <linux/mm.h>
+#include <linux/module.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/sched.h>
 #include <linux/slab.h>
-#include <asm/uaccess.h>
+#include <linux/spinlock.h>
+#include <linux/time.h>
+#include <linux/uaccess.h>
+#include <linux/uio.h>
+#include <linux/version.h>
+#include <linux/wait.h>
 
 #include "buffer.h"
+#include "device.h"
+#include "format.h"
+#include "mcbsp.h"
+#include "module.h"
 
 /******************************************************************************
 	Private declarations and functions
 *******************************************************************************/
 
-struct ads1672_period_status {
-	/* Condition code. */
-	int				cond;
+/* The buffer is made up of one or more separately allocated chunks, each
+ * holding chunk_periods whole periods so that no period crosses from one chunk
+ * to the next. The DMA fills a chunked buffer a period at a time, see
+ * cyclic.c.
+ */
+struct chunk {
+	ads1672_sample_t *		data;
+	dma_addr_t			dma;
+};
+
+/* The buffer is a lock-free ring with a single producer, the bottom half of
+ * the DMA callback, and any number of consumers, one struct ads1672_reader per
+ * open file.
+ *
+ * The producer fills in the status record of each period as it completes and
+ * then publishes it by incrementing write_seq with release semantics. Each
+ * consumer owns its read cursor and nothing else, so consumers never interfere
+ * with each other. The producer never waits for the consumers, so a consumer
+ * checks after copying from a period that the period was not overwritten
+ * meanwhile.
+ *
+ * Sequence numbers are free-running and are compared by unsigned subtraction
+ * so that they wrap safely. The period with sequence number seq remains intact
+ * until write_seq reaches seq + nr_periods, when the DMA starts to fill its
+ * index again.
+ *
+ * Each device has its own buffer, so nothing here is shared between devices.
+ */
+struct ads1672_buf {
+	struct ads1672_device *		adc;
+
+	/* Geometry of the buffer. */
+	uint				period_length;
+	uint				nr_periods;
 
-	/* Number of valid samples. */
-	int				nr_samples;
+	struct chunk *			chunks;
+	uint				nr_chunks;
+	uint				chunk_periods;
 
-	/* Timespec at start of buffer. */
-	struct timespec			ts;
+	/* The producer keeps a list of every reader so that it can wake each
+	 * one only once it has as much data as it asked to wait for.
+	 */
+	struct list_head		readers;
+	spinlock_t			readers_lock;
+
+	/* Sequence number of the most recent period completed with a
+	 * condition other than OK, valid once error_seen is set.
+	 */
+	uint				error_seq;
+	bool				error_seen;
+
+	/* The write position and the status of each period are kept in a
+	 * separately allocated area so that they may be mapped into user
+	 * space.
+	 */
+	struct ads1672_mmap_status *	status;
+	size_t				status_size;
+	struct ads1672_period_status *	period_status;
+
+	/* Number of active mappings of the buffer or status area. */
+	atomic_t			mmap_count;
 };
 
-static ads1672_sample_t *		buffer = NULL;
-static dma_addr_t			buffer_dma = 0;
+/* Back the buffer with ordinary cacheable pages mapped through the streaming
+ * DMA API rather than with uncached coherent memory, so that samples are
+ * copied out through the cache, at the cost of cache maintenance on each
+ * period. Needs at least three periods.
+ */
+static bool				cached_buffer = false;
+module_param(cached_buffer, bool, S_IRUGO);
+
+/* Largest size in bytes of each chunk of the buffer, or 0 to allocate the
+ * whole buffer in one piece. Splitting the buffer allows it to be far larger
+ * than any physically contiguous allocation which is likely to succeed. A
+ * buffer in several chunks can only be mapped into user space if it is a
+ * cached_buffer.
+ */
+static ulong				chunk_size = 0;
+module_param(chunk_size, ulong, S_IRUGO);
+
+static size_t chunk_bytes(struct ads1672_buf * b)
+{
+	return b->chunk_periods * b->period_length *
+		sizeof(ads1672_sample_t);
+}
+
+/* Kernel address of the start of a period. */
+static ads1672_sample_t * period_data(struct ads1672_buf * b, uint period)
+{
+	return b->chunks[period / b->chunk_periods].data +
+		(period % b->chunk_periods) * b->period_length;
+}
+
+/* Kernel address of the sample at the reader's cursor. */
+static ads1672_sample_t * cursor_data(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+
+	return period_data(b, reader->period) + reader->offset;
+}
+
+static dma_addr_t period_dma(struct ads1672_buf * b, uint period)
+{
+	return b->chunks[period / b->chunk_periods].dma +
+		(period % b->chunk_periods) * b->period_length *
+		sizeof(ads1672_sample_t);
+}
+
+/* The largest number of periods, up to chunk_size bytes, which divides the
+ * buffer into equal chunks.
+ */
+static uint choose_chunk_periods(uint period_length, uint nr_periods)
+{
+	size_t period_bytes = period_length * sizeof(ads1672_sample_t);
+	uint n;
+
+	if (!chunk_size)
+		return nr_periods;
+
+	n = min_t(ulong, nr_periods, chunk_size / period_bytes);
+	while (n > 1 && nr_periods % n)
+		n--;
+
+	return n ? n : 1;
+}
+
+/* The buffer is mapped for DMA on behalf of the platform device, whose DMA
+ * mask is set in ads1672_device_init().
+ */
+static struct device * dma_dev(struct ads1672_buf * b)
+{
+	return &b->adc->plat.dev;
+}
+
+static ads1672_sample_t * alloc_samples(struct ads1672_buf * b, size_t size,
+		dma_addr_t * dma)
+{
+	void * p;
+
+	if (!cached_buffer)
+		return dma_alloc_coherent(dma_dev(b), size, dma, GFP_KERNEL);
+
+	p = (void *) __get_free_pages(GFP_KERNEL, get_order(size));
+	if (!p)
+		return NULL;
+
+	*dma = dma_map_single(dma_dev(b), p, size, DMA_FROM_DEVICE);
+	if (dma_mapping_error(dma_dev(b), *dma)) {
+		free_pages((unsigned long) p, get_order(size));
+		return NULL;
+	}
+
+	return p;
+}
+
+static void free_samples(struct ads1672_buf * b, ads1672_sample_t * p,
+		size_t size, dma_addr_t dma)
+{
+	if (!cached_buffer) {
+		dma_free_coherent(dma_dev(b), size, p, dma);
+		return;
+	}
+
+	dma_unmap_single(dma_dev(b), dma, size, DMA_FROM_DEVICE);
+	free_pages((unsigned long) p, get_order(size));
+}
 
-static struct completion		period_completion;
-static uint				current_read_period;
-static uint				current_write_period;
-static uint				current_read_offset;
-static struct ads1672_period_status *	period_status;
+/* Discard any stale cache lines for samples of a cached buffer which the DMA
+ * has written while their period is still being filled.
+ */
+static void sync_samples(struct ads1672_buf * b, uint period, uint offset,
+		uint count)
+{
+	if (cached_buffer)
+		dma_sync_single_for_cpu(dma_dev(b), period_dma(b, period) +
+				offset * sizeof(ads1672_sample_t),
+				count * sizeof(ads1672_sample_t),
+				DMA_FROM_DEVICE);
+}
+
+/* Pass ownership of a period of a cached buffer between CPU and device. */
+static void sync_period(struct ads1672_buf * b, uint period, bool for_cpu)
+{
+	size_t bytes = b->period_length * sizeof(ads1672_sample_t);
+	dma_addr_t dma = period_dma(b, period);
+
+	if (!cached_buffer)
+		return;
+
+	if (for_cpu)
+		dma_sync_single_for_cpu(dma_dev(b), dma, bytes,
+				DMA_FROM_DEVICE);
+	else
+		dma_sync_single_for_device(dma_dev(b), dma, bytes,
+				DMA_FROM_DEVICE);
+}
 
-static int prep_read(uint * count)
+static void free_chunks(struct ads1672_buf * b, struct chunk * c, uint n,
+		size_t size)
 {
+	while (n--)
+		free_samples(b, c[n].data, size, c[n].dma);
+
+	kfree(c);
+}
+
+static void free_buffer(struct ads1672_buf * b)
+{
+	if (b->chunks) {
+		free_chunks(b, b->chunks, b->nr_chunks, chunk_bytes(b));
+		b->chunks = NULL;
+		b->nr_chunks = 0;
+		b->chunk_periods = 0;
+	}
+
+	if (b->status) {
+		free_pages((unsigned long) b->status,
+				get_order(b->status_size));
+		b->status = NULL;
+		b->status_size = 0;
+		b->period_status = NULL;
+	}
+}
+
+/* Allocate a buffer with the given geometry, replacing any existing buffer.
+ * The existing buffer is left untouched if allocation fails.
+ */
+static int alloc_buffer(struct ads1672_buf * b, uint period_length,
+		uint nr_periods)
+{
+	struct chunk * new_chunks;
+	uint new_nr_chunks;
+	uint new_chunk_periods;
+	struct ads1672_mmap_status * new_status;
+	size_t new_status_size;
+	size_t new_buffer_size;
+	size_t new_chunk_size;
+	uint i;
+
+	/* We need at least one period for the DMA to fill while another is
+	 * read.
+	 */
+	if (period_length < 1 || nr_periods < 2)
+		return -EINVAL;
+
+	/* A cached buffer hands each period back to the DMA a period before
+	 * it is filled, which needs a third.
+	 */
+	if (cached_buffer && nr_periods < 3)
+		return -EINVAL;
+
+	new_buffer_size = (size_t) nr_periods * period_length *
+		sizeof(ads1672_sample_t);
+	if (new_buffer_size / nr_periods / sizeof(ads1672_sample_t) !=
+			period_length)
+		return -EINVAL;
+
+	new_chunk_periods = choose_chunk_periods(period_length, nr_periods);
+	new_nr_chunks = nr_periods / new_chunk_periods;
+	new_chunk_size = new_chunk_periods * period_length *
+		sizeof(ads1672_sample_t);
+
+	new_chunks = kcalloc(new_nr_chunks, sizeof(*new_chunks), GFP_KERNEL);
+	if (!new_chunks)
+		return -ENOMEM;
+
+	for (i = 0; i < new_nr_chunks; i++) {
+		new_chunks[i].data = alloc_samples(b, new_chunk_size,
+				&new_chunks[i].dma);
+		if (!new_chunks[i].data) {
+			free_chunks(b, new_chunks, i, new_chunk_size);
+			return -ENOMEM;
+		}
+	}
+	
+	/* The status area is allocated as whole pages so that it can be
+	 * mapped into user space.
+	 */
+	new_status_size = PAGE_ALIGN(sizeof(struct ads1672_mmap_status) +
+			nr_periods * sizeof(struct ads1672_period_status));
+	new_status = (struct ads1672_mmap_status *) __get_free_pages(
+			GFP_KERNEL | __GFP_ZERO, get_order(new_status_size));
+	if (!new_status) {
+		free_chunks(b, new_chunks, new_nr_chunks, new_chunk_size);
+		return -ENOMEM;
+	}
+
+	free_buffer(b);
+
+	b->period_length = period_length;
+	b->nr_periods = nr_periods;
+	b->chunks = new_chunks;
+	b->nr_chunks = new_nr_chunks;
+	b->chunk_periods = new_chunk_periods;
+	b->status = new_status;
+	b->status_size = new_status_size;
+	
+	b->status->nr_periods = b->nr_periods;
+	b->status->period_length = b->period_length;
+	b->period_status = b->status->periods;
+
+	b->status->write_period = 0;
+	b->status->write_seq = 0;
+	b->error_seen = false;
+
+	/* Mark the first period as in use. */
+	b->period_status[0].cond = ADS1672_COND_IN_USE;
+	b->period_status[0].nr_samples = 0;
+	b->period_status[0].nr_lost = 0;
+	b->period_status[0].ts.tv_sec = 0;
+	b->period_status[0].ts.tv_nsec = 0;
+
+	return 0;
+}
+
+/* Each mapping holds a reference on the device, so that the buffer is not torn
+ * down while it is still mapped after the file has been closed.
+ */
+static void ads1672_vma_open(struct vm_area_struct * vma)
+{
+	struct ads1672_buf * b = vma->vm_private_data;
+
+	atomic_inc(&b->mmap_count);
+	ads1672_hold(b->adc);
+}
+
+static void ads1672_vma_close(struct vm_area_struct * vma)
+{
+	struct ads1672_buf * b = vma->vm_private_data;
+	struct ads1672_device * adc = b->adc;
+
+	/* The buffer may be freed once the reference is dropped. */
+	atomic_dec(&b->mmap_count);
+	ads1672_put(adc);
+}
+
+static const struct vm_operations_struct vm_ops = {
+	.open		= ads1672_vma_open,
+	.close		= ads1672_vma_close,
+};
+
+/* Map part of one chunk of a cached buffer at the given address within the
+ * vma. The buffer is mapped cached, its periods are invalidated as they
+ * complete just as for the kernel's own view of them.
+ */
+static int mmap_chunk(struct ads1672_buf * b, struct vm_area_struct * vma,
+		uint c, unsigned long addr, size_t len)
+{
+	return remap_pfn_range(vma, addr,
+			virt_to_phys(b->chunks[c].data) >> PAGE_SHIFT,
+			len, vma->vm_page_prot);
+}
+
+/* Map the chunks one after another, so that the buffer appears contiguous. */
+static int mmap_buffer(struct ads1672_buf * b, struct vm_area_struct * vma)
+{
+	size_t len = vma->vm_end - vma->vm_start;
+	unsigned long addr = vma->vm_start;
+	size_t n;
+	uint c;
+	int r;
+
+	if (len > PAGE_ALIGN(chunk_bytes(b) * b->nr_chunks))
+		return -EINVAL;
+
+	/* dma_mmap_coherent() can only map a whole vma, and coherent memory
+	 * has no pages of its own to map piecewise, so a coherent buffer can
+	 * only be mapped if it is a single chunk.
+	 */
+	if (!cached_buffer) {
+		if (b->nr_chunks > 1)
+			return -EINVAL;
+
+		return dma_mmap_coherent(dma_dev(b), vma, b->chunks[0].data,
+				b->chunks[0].dma, chunk_bytes(b));
+	}
+
+	/* Chunks must start on page boundaries in the mapping. */
+	if (b->nr_chunks > 1 && chunk_bytes(b) & ~PAGE_MASK)
+		return -EINVAL;
+
+	for (c = 0; len; c++) {
+		n = min(len, PAGE_ALIGN(chunk_bytes(b)));
+		r = mmap_chunk(b, vma, c, addr, n);
+		if (r < 0)
+			return r;
+
+		addr += n;
+		len -= n;
+	}
+
+	return 0;
+}
+
+static int mmap_status(struct ads1672_buf * b, struct vm_area_struct * vma)
+{
+	size_t len = vma->vm_end - vma->vm_start;
+
+	if (len > b->status_size)
+		return -EINVAL;
+
+	return remap_pfn_range(vma, vma->vm_start,
+			virt_to_phys(b->status) >> PAGE_SHIFT, len,
+			vma->vm_page_prot);
+}
+
+/* Nominal sample rate in Hz, used to find the time of the first sample in a
+ * period from the time at which the period completed.
+ */
+static uint				sample_rate = ADS1672_SAMPLE_RATE;
+
+/* Every timestamp divides by the sample rate, so refuse a rate of zero. */
+static int set_sample_rate(const char * val, const struct kernel_param * kp)
+{
+	uint rate;
+	int r;
+
+	r = kstrtouint(val, 0, &rate);
+	if (r < 0)
+		return r;
+	if (rate == 0)
+		return -EINVAL;
+
+	return param_set_uint(val, kp);
+}
+
+static const struct kernel_param_ops sample_rate_ops = {
+	.set	= set_sample_rate,
+	.get	= param_get_uint,
+};
+module_param_cb(sample_rate, &sample_rate_ops, &sample_rate, S_IRUGO);
+
+/* Maximum time in milliseconds to wait for a period to complete before a read
+ * fails with -ETIMEDOUT, or 0 to wait indefinitely.
+ */
+static uint				read_timeout = 0;
+module_param(read_timeout, uint, S_IRUGO | S_IWUSR);
+
+/* Has the DMA completed the reader's current period? */
+static int period_ready(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+
+	return smp_load_acquire(&b->status->write_seq) != reader->seq;
+}
+
+/* Should a blocked reader be woken? Once at least one period is complete this
+ * is when the reader has avail_min samples available, when a period it has yet
+ * to read had an error or when the DMA is about to lap it.
+ *
+ * This is called from the producer without the reader lock, so it may see a
+ * stale cursor. The cursor only ever moves forward, so that can only cause a
+ * spurious wakeup, never a missed one.
+ */
+static int wake_ready(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+	uint behind = smp_load_acquire(&b->status->write_seq) - reader->seq;
+
+	if (!behind)
+		return 0;
+
+	if (behind >= b->nr_periods - 1)
+		return 1;
+
+	if (READ_ONCE(b->error_seen) &&
+			READ_ONCE(b->error_seq) - reader->seq < behind)
+		return 1;
+
+	return (u64) behind * b->period_length - reader->offset >=
+		reader->avail_min;
+}
+
+/* Move the read cursor forward by nr periods. */
+static void skip_periods(struct ads1672_reader * reader, uint nr)
+{
+	struct ads1672_buf * b = reader->buf;
+
+	reader->seq += nr;
+	reader->period = (reader->period + nr % b->nr_periods) %
+		b->nr_periods;
+
+	reader->offset = 0;
+	reader->nr_samples = 0;
+	reader->nr_lost = 0;
+	reader->cond = ADS1672_COND_IN_USE;
+	reader->ts.tv_sec = 0;
+	reader->ts.tv_nsec = 0;
+}
+
+/* Index in the buffer of the period with the given sequence number, found
+ * relative to the reader's current period.
+ */
+static uint period_index(struct ads1672_reader * reader, uint seq)
+{
+	struct ads1672_buf * b = reader->buf;
+	int delta = (int) (seq - reader->seq) % (int) b->nr_periods;
+
+	return (reader->period + b->nr_periods + delta) %
+		b->nr_periods;
+}
+
+/* Duration of nr_samples samples at the nominal sample rate. */
+static s64 samples_to_ns(uint nr_samples)
+{
+	return div_u64((u64) nr_samples * NSEC_PER_SEC, sample_rate);
+}
+
+/* Place the read cursor at the period currently being filled. */
+static void reset_reader(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+	uint seq;
+	uint period;
+	uint i;
+
+	/* The write index and sequence number are separate stores, so find the
+	 * index from the record of the last completed period instead and retry
+	 * if another period completes meanwhile.
+	 */
+	do {
+		seq = smp_load_acquire(&b->status->write_seq);
+		period = 0;
+		if (seq) {
+			for (i = 0; i < b->nr_periods; i++) {
+				if (b->period_status[i].seq == seq - 1) {
+					period = (i + 1) % b->nr_periods;
+					break;
+				}
+			}
+		}
+		smp_rmb();
+	} while (smp_load_acquire(&b->status->write_seq) != seq);
+
+	reader->seq = seq;
+	reader->period = period;
+	reader->offset = 0;
+	reader->nr_samples = 0;
+	reader->nr_lost = 0;
+	reader->cond = ADS1672_COND_IN_USE;
+	reader->ts.tv_sec = 0;
+	reader->ts.tv_nsec = 0;
+}
+
+/* If the DMA has lapped the reader, jump to the oldest period which is still
+ * intact and flag an overrun. Returns non-zero if an overrun occurred.
+ */
+static int check_overrun(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+	uint behind = smp_load_acquire(&b->status->write_seq) - reader->seq;
+
+	if (behind < b->nr_periods)
+		return 0;
+
+	skip_periods(reader, behind - (b->nr_periods - 1));
+	reader->cond = ADS1672_COND_OVERRUN;
+	return 1;
+}
+
+/* Get the condition of the reader's current period, taking a copy of its
+ * status record once it is complete.
+ */
+static int load_cond(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+
+	if (reader->cond != ADS1672_COND_IN_USE || !period_ready(reader))
+		return reader->cond;
+
+	reader->cond = b->period_status[reader->period].cond;
+	reader->nr_samples = b->period_status[reader->period].nr_samples;
+	reader->nr_lost = b->period_status[reader->period].nr_lost;
+	reader->ts = b->period_status[reader->period].ts;
+
+	/* The record may have been overwritten while we copied it. */
+	smp_rmb();
+	check_overrun(reader);
+
+	return reader->cond;
+}
+
+/* Sleep until the reader should be woken or the timeout expires, returning as
+ * wait_event_interruptible_timeout() does. This is called with the reader lock
+ * held and drops it while asleep, so that other users of the file can still
+ * get at the reader. The caller must check the state of the reader again
+ * afterwards. While anyone is asleep here the buffer and the format may not be
+ * changed, see ads1672_buf_set_geometry() and ads1672_buf_set_format().
+ */
+static long sleep_unlocked(struct ads1672_reader * reader, long timeout)
+{
+	long r;
+
+	reader->waiters++;
+	mutex_unlock(&reader->lock);
+
+	r = wait_event_interruptible_timeout(reader->wait, wake_ready(reader),
+			timeout);
+
+	mutex_lock(&reader->lock);
+	reader->waiters--;
+	return r;
+}
+
+/* Wait for the reader's current period to be completed. A blocking wait lasts
+ * until the reader's watermark is met, a non-blocking one takes whatever is
+ * complete. Returns 0 once the period is complete or a negative error code if
+ * the wait failed. Called with the reader lock held.
+ */
+static int wait_period(struct ads1672_reader * reader, bool nonblock)
+{
+	long r;
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+
+	if (nonblock)
+		return period_ready(reader) ? 0 : -EAGAIN;
+
+	if (read_timeout)
+		timeout = msecs_to_jiffies(read_timeout);
+
+	/* Another user of the file may have moved the cursor while we slept,
+	 * so check again once we have the lock back.
+	 */
+	while (!wake_ready(reader)) {
+		r = sleep_unlocked(reader, timeout);
+		if (r < 0)
+			return r;
+		if (r == 0)
+			return -ETIMEDOUT;
+		timeout = r;
+	}
+
+	return 0;
+}
+
+/* Number of samples the DMA has written so far into the period being filled,
+ * if the reader is in live mode and that is its current period, else 0.
+ */
+static uint live_samples(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+	uint seq = smp_load_acquire(&b->status->write_seq);
+	dma_addr_t pos;
+	dma_addr_t start;
+	uint index;
+
+	if (!reader->live || seq != reader->seq)
+		return 0;
+
+	pos = ads1672_mcbsp_get_dst_pos(b->adc);
+	start = period_dma(b, reader->period);
+	if (pos <= start)
+		return 0;
+
+	/* If the period completed while we looked, the position may be in
+	 * the next one.
+	 */
+	smp_rmb();
+	if (smp_load_acquire(&b->status->write_seq) != seq)
+		return 0;
+
+	index = (pos - start) / sizeof(ads1672_sample_t);
+	if (index == 0 || index > b->period_length)
+		return 0;
+
+	/* The position counts elements the DMA has issued, the last of which
+	 * may not have reached memory yet.
+	 */
+	return index - 1;
+}
+
+static int live_ready(struct ads1672_reader * reader)
+{
+	return live_samples(reader) >= reader->offset + reader->avail_min;
+}
+
+/* Wait for data to read, which in live mode includes samples already written
+ * into the period being filled. The frame interrupt is the only event, so a
+ * blocking wait in live mode checks the DMA position every tick.
+ */
+static int wait_data(struct ads1672_reader * reader, bool nonblock)
+{
+	unsigned long end = jiffies + msecs_to_jiffies(read_timeout);
+	long r;
+
+	if (!reader->live)
+		return wait_period(reader, nonblock);
+
+	if (nonblock)
+		return (period_ready(reader) ||
+			live_samples(reader) > reader->offset) ? 0 : -EAGAIN;
+
+	while (!wake_ready(reader) && !live_ready(reader)) {
+		r = sleep_unlocked(reader, 1);
+		if (r < 0)
+			return r;
+		if (read_timeout && time_after(jiffies, end))
+			return -ETIMEDOUT;
+	}
+
+	return 0;
+}
+
+static int prep_read(struct ads1672_reader * reader, uint * count,
+		bool nonblock)
+{
+	struct ads1672_buf * b = reader->buf;
+	int r;
 	uint avail;
 	
 	if (*count < 1)
 		return -EINVAL;
 	
-	/* If the current buffer is marked as in use, then the following should
-	 * apply:
-	 * 	period_status[current_read_period].nr_samples = 0
-	 * 	current_read_offset = 0
-	 *
-	 * Therefore:
-	 * 	available samples = 0
-	 *
-	 * So we need to check whether the current buffer is marked as in use
-	 * before we calculate the number of available samples.
-	 */
-	/* If the current read period is the same as the current write period,
-	 * wait for the write to finish. */
-	if (current_read_period == current_write_period)
-		wait_for_completion(&period_completion);
-
-	/* On an error condition the number of available samples may also be
-	 * zero, so again we need to check for this before calculating the
-	 * number of available samples.
-	 */
-	if (period_status[current_read_period].cond != ADS1672_COND_OK)
-		return -EIO;
-	
-	/* Now the number of available samples can only be zero if the current
-	 * period is valid but all data has been read.
-	 */
-	avail = period_status[current_read_period].nr_samples - current_read_offset;
-	if (avail == 0) {
-		/* Move to the next period and wait if it is marked as in use.
+	for (;;) {
+		/* If the current read period is still being filled, wait for
+		 * the write to finish.
+		 */
+		r = wait_data(reader, nonblock);
+		if (r < 0)
+			return r;
+
+		/* In live mode we may have been given samples from the period
+		 * being filled. These have no condition yet.
 		 */
-		current_read_offset = 0;
-		current_read_period++;
-		if (current_read_period == ads1672_nr_periods)
-			current_read_period = 0;
-		if (current_read_period == current_write_period)
-			wait_for_completion(&period_completion);
-
-		/* We need to check for an error condition again. */
-		if (period_status[current_read_period].cond != ADS1672_COND_OK)
+		if (!period_ready(reader)) {
+			avail = live_samples(reader);
+			if (avail <= reader->offset)
+				continue;
+
+			avail -= reader->offset;
+			sync_samples(b, reader->period, reader->offset, avail);
+			break;
+		}
+
+		check_overrun(reader);
+
+		/* On an error condition the number of available samples may
+		 * be zero, so we need to check for this before calculating the
+		 * number of available samples.
+		 */
+		if (load_cond(reader) != ADS1672_COND_OK)
 			return -EIO;
 
-		/* Recalculate available samples - this should never be zero */
-		avail = period_status[current_read_period].nr_samples -
-			current_read_offset;
+		/* Live reads may have taken us past the end of a period which
+		 * completed short.
+		 */
+		avail = 0;
+		if (reader->nr_samples > reader->offset)
+			avail = reader->nr_samples - reader->offset;
+		if (avail)
+			break;
+
+		/* Nothing left in this period, move to the next one. */
+		skip_periods(reader, 1);
 	}
 
 	/* Read upto count samples from the current offset to end of current
@@ -115,166 +815,829 @@ static int prep_read(uint * count)
 	return 0;
 }
 
+/* Pack samples in the reader's format and copy them to an iterator, a bounce
+ * buffer at a time. Returns 0 on success or non-zero if the copy faulted.
+ */
+static int copy_packed(struct ads1672_reader * reader, struct iov_iter * to,
+		const ads1672_sample_t * in, uint count)
+{
+	size_t size = ads1672_format_sample_size(reader->format);
+	uint chunk;
+
+	while (count) {
+		chunk = min_t(uint, count, ADS1672_BOUNCE_SAMPLES);
+
+		ads1672_format_pack(reader->format, reader->bounce, in, chunk);
+		if (copy_to_iter(reader->bounce, chunk * size, to) !=
+				chunk * size)
+			return -EFAULT;
+
+		in += chunk;
+		count -= chunk;
+	}
+
+	return 0;
+}
+
+/* Account for count samples having been copied out of the current period. */
+static int finish_read(struct ads1672_reader * reader, uint count)
+{
+	/* The DMA never waits for us, so make sure it did not start refilling
+	 * the period while we were copying from it.
+	 */
+	smp_rmb();
+	if (check_overrun(reader))
+		return -EIO;
+
+	/* Release the period as soon as it has been fully read, so that the
+	 * DMA can only lap us if we really have fallen behind.
+	 */
+	reader->offset += count;
+	if (reader->offset == reader->nr_samples)
+		skip_periods(reader, 1);
+
+	return count;
+}
+
 /*******************************************************************************
 	Public functions
 *******************************************************************************/
 
-uint				ads1672_nr_periods;
-uint				ads1672_period_length;
+uint				ads1672_nr_periods = ADS1672_NR_PERIODS;
+module_param_named(nr_periods, ads1672_nr_periods, uint, S_IRUGO);
+
+uint				ads1672_period_length = ADS1672_PERIOD_LENGTH;
+module_param_named(period_length, ads1672_period_length, uint, S_IRUGO);
 
-int ads1672_buf_readk(ads1672_sample_t * out, uint count)
+void ads1672_buf_reader_init(struct ads1672_device * adc,
+		struct ads1672_reader * reader)
 {
-	int r;
-	uint index;
+	struct ads1672_buf * b = adc->buf;
+	unsigned long flags;
+
+	reader->buf = b;
+	mutex_init(&reader->lock);
+	init_waitqueue_head(&reader->wait);
+	reader->avail_min = 1;
+	reader->live = false;
+	reader->gang = NULL;
+	reader->waiters = 0;
+	reader->format = ADS1672_FORMAT_S32;
+	reader->bounce = NULL;
+	reset_reader(reader);
+
+	spin_lock_irqsave(&b->readers_lock, flags);
+	list_add_tail(&reader->list, &b->readers);
+	spin_unlock_irqrestore(&b->readers_lock, flags);
+}
+
+void ads1672_buf_reader_exit(struct ads1672_reader * reader)
+{
+	struct ads1672_buf * b = reader->buf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&b->readers_lock, flags);
+	list_del(&reader->list);
+	spin_unlock_irqrestore(&b->readers_lock, flags);
+
+	kfree(reader->bounce);
+	reader->bounce = NULL;
+}
+
+void ads1672_buf_set_live(struct ads1672_reader * reader, bool live)
+{
+	mutex_lock(&reader->lock);
+	reader->live = live;
+	mutex_unlock(&reader->lock);
+}
+
+int ads1672_buf_set_avail_min(struct ads1672_reader * reader, uint avail_min)
+{
+	if (avail_min < 1)
+		return -EINVAL;
+
+	mutex_lock(&reader->lock);
+	reader->avail_min = avail_min;
+	mutex_unlock(&reader->lock);
+
+	/* A lower watermark may already be met. */
+	wake_up_interruptible(&reader->wait);
+	return 0;
+}
+
+int ads1672_buf_set_format(struct ads1672_reader * reader, int format)
+{
+	void * bounce = NULL;
+
+	if (!ads1672_format_sample_size(format))
+		return -EINVAL;
+
+	/* Formats other than the native one are packed into a bounce buffer
+	 * before being copied to user space.
+	 */
+	if (format != ADS1672_FORMAT_S32) {
+		bounce = kmalloc(ADS1672_BOUNCE_SIZE, GFP_KERNEL);
+		if (!bounce)
+			return -ENOMEM;
+	}
+
+	mutex_lock(&reader->lock);
+
+	/* A read asleep on the buffer carries on in the format it started
+	 * with.
+	 */
+	if (reader->waiters) {
+		mutex_unlock(&reader->lock);
+		kfree(bounce);
+		return -EBUSY;
+	}
+
+	kfree(reader->bounce);
+	reader->bounce = bounce;
+	reader->format = format;
+	mutex_unlock(&reader->lock);
+
+	return 0;
+}
+
+ssize_t ads1672_buf_readk(struct ads1672_reader * reader, void * out,
+		size_t len, bool nonblock)
+{
+	size_t size;
+	uint count;
+	uint done = 0;
+	uint n;
+	int format;
+	int r = 0;
+
+	mutex_lock(&reader->lock);
+
+	/* The format may only change under the lock, and not at all while we
+	 * sleep in prep_read(), so this copy holds for the whole read.
+	 */
+	format = reader->format;
+	size = ads1672_format_sample_size(format);
+	count = len / size;
+	if (count < 1) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	/* Keep reading across period boundaries until the request is filled.
+	 * Only the first period is waited for, after that we return what is
+	 * ready and stop short of any period with a condition other than OK.
+	 */
+	while (done < count) {
+		n = count - done;
+		r = prep_read(reader, &n, nonblock || done);
+		if (r < 0)
+			break;
+
+		ads1672_format_pack(format, out, cursor_data(reader), n);
+		r = finish_read(reader, n);
+		if (r < 0)
+			break;
+
+		done += r;
+		out += r * size;
+	}
+
+	if (done)
+		r = done * size;
+
+out:
+	mutex_unlock(&reader->lock);
+	return r;
+}
+
+ssize_t ads1672_buf_read_iter(struct ads1672_reader * reader,
+		struct iov_iter * to, bool nonblock)
+{
+	size_t size;
+	uint count;
+	uint done = 0;
+	uint n;
+	int format;
+	int r = 0;
+
+	/* A non-blocking caller must not sleep on another user of this file
+	 * either.
+	 */
+	if (nonblock) {
+		if (!mutex_trylock(&reader->lock))
+			return -EAGAIN;
+	} else {
+		mutex_lock(&reader->lock);
+	}
+
+	/* As for ads1672_buf_readk(). */
+	format = reader->format;
+	size = ads1672_format_sample_size(format);
+	count = iov_iter_count(to) / size;
+	if (count < 1) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	while (done < count) {
+		n = count - done;
+		r = prep_read(reader, &n, nonblock || done);
+		if (r < 0)
+			break;
+
+		if (format == ADS1672_FORMAT_S32)
+			r = copy_to_iter(cursor_data(reader),
+					n * sizeof(ads1672_sample_t), to) !=
+				n * sizeof(ads1672_sample_t);
+		else
+			r = copy_packed(reader, to, cursor_data(reader), n);
+		if (r != 0) {
+			r = -EFAULT;
+			break;
+		}
 	
-	r = prep_read(&count);
-	if (r < 0)
-		return r;
+		r = finish_read(reader, n);
+		if (r < 0)
+			break;
 
-	index = current_read_period * ads1672_period_length + current_read_offset;
+		done += r;
+	}
 
-	memcpy(out, &buffer[index], count * sizeof(ads1672_sample_t));
-	current_read_offset += count;
-	return count;
+	if (done)
+		r = done * size;
+
+out:
+	mutex_unlock(&reader->lock);
+	return r;
 }
 
-int ads1672_buf_readu(ads1672_sample_t __user * out, uint count)
+int ads1672_buf_read_periods(struct ads1672_reader * reader,
+		ads1672_sample_t __user * data,
+		struct ads1672_period_status __user * records, uint max,
+		bool nonblock)
 {
+	struct ads1672_buf * b = reader->buf;
+	struct ads1672_period_status rec;
+	uint count;
+	uint n = 0;
+	int overrun;
 	int r;
-	uint index;
-	
-	r = prep_read(&count);
+
+	if (max < 1)
+		return -EINVAL;
+
+	/* No more than the whole ring can be ready at once. */
+	max = min(max, b->nr_periods);
+
+	mutex_lock(&reader->lock);
+
+	r = wait_period(reader, nonblock);
 	if (r < 0)
-		return r;
+		goto out;
 
-	index = current_read_period * ads1672_period_length + current_read_offset;
+	while (n < max && period_ready(reader)) {
+		/* An overrun hides the condition of the period we skipped to,
+		 * so note it and load the real record. Loading may find that
+		 * we have been lapped again.
+		 */
+		overrun = 0;
+		do {
+			check_overrun(reader);
+			if (reader->cond == ADS1672_COND_OVERRUN) {
+				overrun = 1;
+				reader->cond = ADS1672_COND_IN_USE;
+			}
+		} while (load_cond(reader) == ADS1672_COND_OVERRUN);
 
-	r = copy_to_user(out, &buffer[index], count * sizeof(ads1672_sample_t));
-	if (r != 0)
-		return -EIO;
-	
-	current_read_offset += count;
-	return count;
+		count = reader->nr_samples - reader->offset;
+
+		rec.cond = overrun ? ADS1672_COND_OVERRUN : reader->cond;
+		rec.nr_samples = count;
+		rec.seq = reader->seq;
+		rec.nr_lost = reader->nr_lost;
+		ads1672_buf_ns_to_ts(ads1672_buf_ts_to_ns(&reader->ts) +
+				samples_to_ns(reader->offset), &rec.ts);
+
+		/* A fault after the first period returns the periods already
+		 * copied, the faulting one stays at the cursor.
+		 */
+		if (copy_to_user(&data[(size_t) n * b->period_length],
+				cursor_data(reader),
+				count * sizeof(ads1672_sample_t))) {
+			r = n ? n : -EFAULT;
+			goto out;
+		}
+
+		/* If the period was overwritten while we copied it, drop it.
+		 * The next period will be flagged as overrun.
+		 */
+		smp_rmb();
+		if (check_overrun(reader))
+			continue;
+
+		if (copy_to_user(&records[n], &rec, sizeof(rec))) {
+			r = n ? n : -EFAULT;
+			goto out;
+		}
+
+		skip_periods(reader, 1);
+		n++;
+	}
+
+	r = n;
+
+out:
+	mutex_unlock(&reader->lock);
+	return r;
 }
 
-void ads1672_buf_complete(int cond, uint nr_samples)
+void ads1672_buf_complete(struct ads1672_device * adc, int cond,
+		uint nr_samples, uint nr_lost, const struct timespec64 * end)
 {
-	/* Set values of the finished period. */
-	period_status[current_write_period].cond = cond;
-	period_status[current_write_period].nr_samples = nr_samples;
-	period_status[current_write_period].ts.tv_sec = 0;
-	period_status[current_write_period].ts.tv_nsec = 0;
+	struct ads1672_buf * b = adc->buf;
+	struct ads1672_reader * reader;
+	uint period = b->status->write_period;
+	uint next = period + 1;
+	uint ahead;
 
-	/* Advance the current write period. */
-	current_write_period++;
-	if (current_write_period == ads1672_nr_periods)
-		current_write_period = 0;
+	if (next == b->nr_periods)
+		next = 0;
+	ahead = next + 1;
+	if (ahead == b->nr_periods)
+		ahead = 0;
 
-	/* Check for overrun - if this has happened, advance the current read
-	 * period and mark the overrun condition.
+	/* Set values of the finished period. The timestamp is that of the
+	 * first valid sample, which arrived nr_samples sample periods before
+	 * the end of the period.
 	 */
-	if (current_write_period == current_read_period) {
-		current_read_offset = 0;
-		current_read_period++;
-		if (current_read_period == ads1672_nr_periods)
-			current_read_period = 0;
-		period_status[current_read_period].cond = ADS1672_COND_OVERRUN;
+	b->period_status[period].cond = cond;
+	b->period_status[period].nr_samples = nr_samples;
+	b->period_status[period].nr_lost = nr_lost;
+	b->period_status[period].seq = b->status->write_seq;
+	ads1672_buf_ns_to_ts(timespec64_to_ns(end) - samples_to_ns(nr_samples),
+			&b->period_status[period].ts);
+
+	if (cond != ADS1672_COND_OK) {
+		b->error_seq = b->status->write_seq;
+		b->error_seen = true;
 	}
 
-	/* Mark the new write period as in use just incase. */
-	period_status[current_write_period].cond = ADS1672_COND_IN_USE;
-	period_status[current_write_period].nr_samples = 0;
+	/* Discard any stale cache lines for the finished period before it is
+	 * read. The DMA is already filling next, which was handed back to it
+	 * when the period before completed, so hand back the one it fills
+	 * after that now, before the DMA owns it. The buffer starts out owned
+	 * by the DMA and write_period only moves here, so this holds across a
+	 * stop and restart. A reader still copying out of the period handed
+	 * back reads the same samples from memory until the DMA overwrites
+	 * them, which it detects as an overrun as before.
+	 */
+	sync_period(b, period, true);
+	sync_period(b, ahead, false);
+
+	/* The DMA has already moved on to the next period, mark it as in use.
+	 * Any reader still holding it will see the overrun once write_seq is
+	 * published.
+	 */
+	b->period_status[next].cond = ADS1672_COND_IN_USE;
+	b->period_status[next].nr_samples = 0;
+	b->period_status[next].nr_lost = 0;
+	b->status->write_period = next;
+
+	/* Publish the finished period. */
+	smp_store_release(&b->status->write_seq, b->status->write_seq + 1);
 
-	/* Raise the completion incase someone was waiting for data. */
-	complete(&period_completion);
+	/* Wake up readers whose watermark has been met. */
+	spin_lock(&b->readers_lock);
+	list_for_each_entry(reader, &b->readers, list) {
+		if (wake_ready(reader))
+			wake_up_interruptible(&reader->wait);
+	}
+	spin_unlock(&b->readers_lock);
 }
 
-void ads1672_buf_flush(void)
+void ads1672_buf_flush(struct ads1672_reader * reader)
 {
 	/* Discard current buffer and move to the next one. We assume that the
 	 * reader knows what they are doing and will correct any timing info it
 	 * holds.
 	 */
-	current_read_period++;
-	if (current_read_period == ads1672_nr_periods)
-		current_read_period = 0;
-	current_read_offset = 0;
+	mutex_lock(&reader->lock);
+	if (period_ready(reader))
+		skip_periods(reader, 1);
+	mutex_unlock(&reader->lock);
 }
 
-void ads1672_buf_clear_cond(void)
+int ads1672_buf_wait(struct ads1672_reader * reader,
+		struct ads1672_position * pos, bool nonblock)
 {
-	/* We assume the caller knows what they're doing. */
-	period_status[current_read_period].cond = ADS1672_COND_OK;
+	int r;
+
+	mutex_lock(&reader->lock);
+
+	r = wait_period(reader, nonblock);
+	if (r < 0)
+		goto out;
+
+	check_overrun(reader);
+	pos->cond = load_cond(reader);
+	pos->seq = reader->seq;
+	pos->period = reader->period;
+	pos->offset = reader->offset;
+
+out:
+	mutex_unlock(&reader->lock);
+	return r;
 }
 
-dma_addr_t ads1672_buf_get_dma_addr(void)
+int ads1672_buf_sleep(struct ads1672_reader * reader)
 {
-	return buffer_dma;
+	long r;
+	long timeout = MAX_SCHEDULE_TIMEOUT;
+
+	if (read_timeout)
+		timeout = msecs_to_jiffies(read_timeout);
+
+	r = wait_event_interruptible_timeout(reader->wait, wake_ready(reader),
+			timeout);
+	if (r < 0)
+		return r;
+	if (r == 0)
+		return -ETIMEDOUT;
+
+	return 0;
 }
 
-int ads1672_buf_get_cond(void)
+unsigned int ads1672_buf_poll(struct ads1672_reader * reader, struct file * f,
+		poll_table * wait)
 {
-	return period_status[current_read_period].cond;
+	struct ads1672_buf * b = reader->buf;
+	unsigned int mask = 0;
+	int cond;
+
+	poll_wait(f, &reader->wait, wait);
+
+	/* Readable once the reader's watermark is met. A condition other than
+	 * OK will cause the next read to fail until it is cleared, so also
+	 * flag it as priority data. This only peeks at the reader so it does
+	 * not need to take the lock.
+	 */
+	if (wake_ready(reader) || live_ready(reader))
+		mask |= POLLIN | POLLRDNORM;
+
+	if (period_ready(reader)) {
+		cond = reader->cond;
+		if (smp_load_acquire(&b->status->write_seq) - reader->seq >=
+				b->nr_periods)
+			cond = ADS1672_COND_OVERRUN;
+		else if (cond == ADS1672_COND_IN_USE)
+			cond = b->period_status[reader->period].cond;
+
+		if (cond != ADS1672_COND_OK)
+			mask |= POLLPRI;
+	}
+
+	return mask;
 }
 
-void ads1672_buf_get_timespec(struct timespec * ts)
+int ads1672_buf_advance(struct ads1672_reader * reader)
 {
-	*ts = period_status[current_read_offset].ts;
+	int r = 0;
+
+	mutex_lock(&reader->lock);
+
+	/* Refuse to move the read cursor past the period being filled. */
+	if (period_ready(reader))
+		skip_periods(reader, 1);
+	else
+		r = -EBUSY;
+
+	mutex_unlock(&reader->lock);
+	return r;
 }
 
-int ads1672_buf_init(void)
+int ads1672_buf_seek(struct ads1672_reader * reader, uint seq)
 {
-	size_t buffer_size;
+	struct ads1672_buf * b = reader->buf;
+	uint ahead;
+	int r = 0;
 
-	/* Set ads1672_nr_periods and ads1672_period_length to constants from the header.
-	 * Keeping these as variables allows them to be changed later.
+	mutex_lock(&reader->lock);
+
+	/* The cursor only moves forward, and never past the period being
+	 * filled.
 	 */
-	ads1672_nr_periods = ADS1672_NR_PERIODS;
-	ads1672_period_length = ADS1672_PERIOD_LENGTH;
+	ahead = seq - reader->seq;
+	if (ahead > smp_load_acquire(&b->status->write_seq) - reader->seq)
+		r = -EINVAL;
+	else if (ahead)
+		skip_periods(reader, ahead);
 
-	buffer_size = ads1672_nr_periods * ads1672_period_length *
-		sizeof(ads1672_sample_t);
-	
-	buffer = (ads1672_sample_t *) dma_alloc_coherent(NULL, buffer_size,
-			&buffer_dma, GFP_KERNEL);
-	if (!buffer)
-		return -ENOMEM;
-	
-	period_status = (struct ads1672_period_status *) kmalloc(ads1672_nr_periods *
-			sizeof(struct ads1672_period_status), GFP_KERNEL);
-	if (!period_status) {
-		dma_free_coherent(NULL, buffer_size, buffer, buffer_dma);
-		return -ENOMEM;
+	mutex_unlock(&reader->lock);
+	return r;
+}
+
+int ads1672_buf_mmap(struct ads1672_device * adc,
+		struct vm_area_struct * vma)
+{
+	struct ads1672_buf * b = adc->buf;
+	int r;
+
+	/* Both areas are strictly read-only, the cursor is only moved through
+	 * ads1672_buf_advance().
+	 */
+	if (vma->vm_flags & VM_WRITE)
+		return -EPERM;
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 3, 0)
+	vm_flags_clear(vma, VM_MAYWRITE);
+#else
+	vma->vm_flags &= ~VM_MAYWRITE;
+#endif
+
+	/* Map the buffer and count the mapping under the lock that
+	 * ads1672_buf_set_geometry() is called with, so that the buffer cannot
+	 * be reallocated between the two.
+	 */
+	mutex_lock(&adc->geometry_lock);
+
+	switch (vma->vm_pgoff) {
+		case ADS1672_MMAP_DATA_OFFSET >> PAGE_SHIFT:
+			r = mmap_buffer(b, vma);
+			break;
+
+		case ADS1672_MMAP_STATUS_OFFSET >> PAGE_SHIFT:
+			r = mmap_status(b, vma);
+			break;
+
+		default:
+			r = -EINVAL;
+			break;
 	}
-	
-	init_completion(&period_completion);
 
-	current_read_period = 0;
-	current_write_period = 0;
-	current_read_offset = 0;
+	/* Track mappings so that the buffer is not reallocated beneath them. */
+	if (r == 0) {
+		vma->vm_ops = &vm_ops;
+		vma->vm_private_data = b;
+		ads1672_vma_open(vma);
+	}
 
-	/* Mark the first period as in use. */
-	period_status[0].cond = ADS1672_COND_IN_USE;
-	period_status[0].nr_samples = 0;
-	period_status[0].ts.tv_sec = 0;
-	period_status[0].ts.tv_nsec = 0;
-	
+	mutex_unlock(&adc->geometry_lock);
+	return r;
+}
+
+void ads1672_buf_clear_cond(struct ads1672_reader * reader)
+{
+	mutex_lock(&reader->lock);
+
+	/* Clearing an overrun exposes the real condition of the period we
+	 * skipped to. A period which is still in use has no condition to clear.
+	 */
+	if (reader->cond == ADS1672_COND_OVERRUN)
+		reader->cond = ADS1672_COND_IN_USE;
+	else if (reader->cond != ADS1672_COND_IN_USE)
+		reader->cond = ADS1672_COND_OK;
+
+	mutex_unlock(&reader->lock);
+}
+
+s64 ads1672_buf_samples_to_ns(uint nr_samples)
+{
+	return samples_to_ns(nr_samples);
+}
+
+uint ads1672_buf_ns_to_samples(s64 ns)
+{
+	if (ns <= 0)
+		return 0;
+
+	return div_u64((u64) ns * sample_rate + NSEC_PER_SEC / 2,
+			NSEC_PER_SEC);
+}
+
+void ads1672_buf_ns_to_ts(s64 ns, struct __kernel_timespec * ts)
+{
+	struct timespec64 t = ns_to_timespec64(ns);
+
+	ts->tv_sec = t.tv_sec;
+	ts->tv_nsec = t.tv_nsec;
+}
+
+s64 ads1672_buf_ts_to_ns(const struct __kernel_timespec * ts)
+{
+	return ts->tv_sec * NSEC_PER_SEC + ts->tv_nsec;
+}
+
+uint ads1672_buf_get_write_period(struct ads1672_device * adc)
+{
+	return adc->buf->status->write_period;
+}
+
+uint ads1672_buf_get_write_seq(struct ads1672_device * adc)
+{
+	return smp_load_acquire(&adc->buf->status->write_seq);
+}
+
+void ads1672_buf_set_start(struct ads1672_device * adc, uint seq,
+		const struct __kernel_timespec * ts)
+{
+	struct ads1672_mmap_status * status = adc->buf->status;
+
+	status->start_seq = seq;
+	if (ts) {
+		status->start_ts = *ts;
+	} else {
+		status->start_ts.tv_sec = 0;
+		status->start_ts.tv_nsec = 0;
+	}
+}
+
+dma_addr_t ads1672_buf_get_dma_addr(struct ads1672_device * adc)
+{
+	return adc->buf->chunks ? adc->buf->chunks[0].dma : 0;
+}
+
+dma_addr_t ads1672_buf_get_period_dma(struct ads1672_device * adc, uint period)
+{
+	return period_dma(adc->buf, period);
+}
+
+uint ads1672_buf_get_chunk_periods(struct ads1672_device * adc)
+{
+	return adc->buf->chunk_periods;
+}
+
+int ads1672_buf_find_dma(struct ads1672_device * adc, dma_addr_t pos,
+		uint * index)
+{
+	struct ads1672_buf * b = adc->buf;
+	struct chunk * c;
+	uint i;
+
+	for (i = 0; i < b->nr_chunks; i++) {
+		c = &b->chunks[i];
+		if (pos >= c->dma && pos - c->dma < chunk_bytes(b)) {
+			*index = i * b->chunk_periods * b->period_length +
+				(pos - c->dma) / sizeof(ads1672_sample_t);
+			return 0;
+		}
+	}
+
+	return -EINVAL;
+}
+
+int ads1672_buf_get_cond(struct ads1672_reader * reader)
+{
+	int cond;
+
+	mutex_lock(&reader->lock);
+	check_overrun(reader);
+	cond = load_cond(reader);
+	mutex_unlock(&reader->lock);
+
+	return cond;
+}
+
+void ads1672_buf_get_timespec(struct ads1672_reader * reader,
+		struct __kernel_timespec * ts)
+{
+	mutex_lock(&reader->lock);
+	check_overrun(reader);
+	load_cond(reader);
+	*ts = reader->ts;
+	mutex_unlock(&reader->lock);
+}
+
+int ads1672_buf_get_sample_time(struct ads1672_reader * reader, u64 index,
+		struct __kernel_timespec * ts)
+{
+	struct ads1672_buf * b = reader->buf;
+	struct ads1672_period_status first, last, ref;
+	uint ws, nr, seq;
+	u32 offset;
+	s64 period_ns, ns;
+	int delta;
+
+	/* Split the index into a period sequence number and an offset. */
+	seq = (uint) div_u64_rem(index, b->period_length, &offset);
+
+	mutex_lock(&reader->lock);
+
+	/* Take copies of the oldest and newest intact status records, and of
+	 * the record for the requested period if it is still in the buffer.
+	 * Retry if the DMA overwrites any of them while we copy.
+	 */
+	do {
+		ws = smp_load_acquire(&b->status->write_seq);
+		if (ws == 0) {
+			mutex_unlock(&reader->lock);
+			return -ENODATA;
+		}
+
+		nr = min(ws, b->nr_periods - 1);
+		first = b->period_status[period_index(reader, ws - nr)];
+		last = b->period_status[period_index(reader, ws - 1)];
+
+		delta = (int) (seq - first.seq);
+		if (delta <= 0)
+			ref = first;
+		else if ((uint) delta >= nr)
+			ref = last;
+		else
+			ref = b->period_status[period_index(reader, seq)];
+
+		smp_rmb();
+	} while (smp_load_acquire(&b->status->write_seq) != ws ||
+			first.seq != ws - nr || last.seq != ws - 1);
+
+	mutex_unlock(&reader->lock);
+
+	/* Measure the period duration across the buffer, falling back to the
+	 * nominal rate if there is only one period to go on.
+	 */
+	if (last.seq != first.seq)
+		period_ns = div_s64(ads1672_buf_ts_to_ns(&last.ts) -
+				ads1672_buf_ts_to_ns(&first.ts),
+				last.seq - first.seq);
+	else
+		period_ns = samples_to_ns(b->period_length);
+
+	/* Interpolate, or extrapolate if the period has left the buffer or
+	 * not yet completed.
+	 */
+	delta = (int) (seq - ref.seq);
+	ns = ads1672_buf_ts_to_ns(&ref.ts) + (s64) delta * period_ns +
+		div_s64((s64) offset * period_ns, b->period_length);
+
+	ads1672_buf_ns_to_ts(ns, ts);
 	return 0;
 }
 
-void ads1672_buf_exit(void)
+int ads1672_buf_set_geometry(struct ads1672_reader * reader,
+		uint period_length, uint nr_periods)
 {
-	if (buffer) {
-		size_t buffer_size = ads1672_nr_periods * ads1672_period_length *
-			sizeof(ads1672_sample_t);
+	struct ads1672_buf * b = reader->buf;
+	int r;
+
+	/* The mapping size was checked against the old geometry. The caller
+	 * holds geometry_lock, which ads1672_buf_mmap() also takes, so no new
+	 * mapping can be made until we are done.
+	 */
+	if (atomic_read(&b->mmap_count))
+		return -EBUSY;
+
+	mutex_lock(&reader->lock);
 
-		dma_free_coherent(NULL, buffer_size, buffer, buffer_dma);
-		buffer = NULL;
-		buffer_dma = 0;
+	/* A thread of this file asleep on the buffer must not find it gone
+	 * when it wakes.
+	 */
+	if (reader->waiters) {
+		mutex_unlock(&reader->lock);
+		return -EBUSY;
 	}
 
-	if (period_status) {
-		kfree(period_status);
-		period_status = NULL;
+	r = alloc_buffer(b, period_length, nr_periods);
+	if (r == 0) {
+		b->adc->period_length = period_length;
+		b->adc->nr_periods = nr_periods;
+		reset_reader(reader);
 	}
+
+	mutex_unlock(&reader->lock);
+	return r;
+}
+
+int ads1672_buf_init(struct ads1672_device * adc)
+{
+	struct ads1672_buf * b;
+	int r;
+
+	b = kzalloc(sizeof(*b), GFP_KERNEL);
+	if (!b)
+		return -ENOMEM;
+
+	b->adc = adc;
+	INIT_LIST_HEAD(&b->readers);
+	spin_lock_init(&b->readers_lock);
+	atomic_set(&b->mmap_count, 0);
+
+	/* The device starts out with the geometry given by the module
+	 * parameters, see device.c.
+	 */
+	r = alloc_buffer(b, adc->period_length, adc->nr_periods);
+	if (r < 0) {
+		kfree(b);
+		return r;
+	}
+
+	adc->buf = b;
+	return 0;
+}
+
+void ads1672_buf_exit(struct ads1672_device * adc)
+{
+	if (!adc->buf)
+		return;
+
+	free_buffer(adc->buf);
+	kfree(adc->buf);
+	adc->buf = NULL;
 }
@@ -25,77 +25,393 @@
 #define __ADS1672_BUFFER_H_INCLUDED__
 
 #include <ads1672.h>
-#include <asm/uaccess.h>
-#include <plat/dma.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/time64.h>
+#include <linux/types.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+#include <linux/uaccess.h>
+
+/**
+ * Size of the bounce buffer used to pack samples into formats other than
+ * ADS1672_FORMAT_S32, and the number of buffer samples packed into it at a time.
+ */
+#define ADS1672_BOUNCE_SIZE		PAGE_SIZE
+#define ADS1672_BOUNCE_SAMPLES		(ADS1672_BOUNCE_SIZE / sizeof(ads1672_sample_t))
+
+struct ads1672_buf;
+struct ads1672_device;
+struct ads1672_gang;
+
+/**
+ * Read cursor of a single reader. Each open file has its own reader so that
+ * every reader sees the full stream.
+ */
+struct ads1672_reader {
+	/* Buffer of the device being read. */
+	struct ads1672_buf *		buf;
+
+	/* Sequence number of the period currently being read. */
+	uint				seq;
+
+	/* Index of the period currently being read. */
+	uint				period;
+
+	/* Offset of the next sample to read within the current period. */
+	uint				offset;
+
+	/* Copy of the number of valid samples in the current period. */
+	uint				nr_samples;
+
+	/* Copy of the number of samples lost in the current period. */
+	uint				nr_lost;
+
+	/* Condition of the current period, ADS1672_COND_IN_USE until the
+	 * period has completed and its status record has been copied.
+	 */
+	int				cond;
+
+	/* Copy of the timestamp of the current period. */
+	struct __kernel_timespec	ts;
+
+	/* Output format, one of ::ADS1672_FORMAT. */
+	int				format;
+
+	/* Bounce buffer for packed formats, NULL for ADS1672_FORMAT_S32. */
+	void *				bounce;
+
+	/* Number of samples which must be available before a blocking read or
+	 * poll wakes up.
+	 */
+	uint				avail_min;
+
+	/* Also read samples from the period being filled. */
+	bool				live;
+
+	/* Devices read together with this one, or NULL. Only set on the
+	 * reader of an open file, see gang.c.
+	 */
+	struct ads1672_gang *		gang;
+
+	/* Woken when the watermark is met. */
+	wait_queue_head_t		wait;
+
+	/* Number of threads asleep on the wait queue, which do not hold the
+	 * lock while they sleep.
+	 */
+	uint				waiters;
+
+	/* Entry in the list of all readers. */
+	struct list_head		list;
+
+	/* Serialises use of the reader by threads sharing an open file. */
+	struct mutex			lock;
+};
+
+/**
+ * Initialize a reader of a device's buffer, placing its cursor at the period
+ * currently being filled.
+ */
+void ads1672_buf_reader_init(struct ads1672_device * adc,
+		struct ads1672_reader * reader);
+
+/**
+ * Free any memory held by a reader.
+ */
+void ads1672_buf_reader_exit(struct ads1672_reader * reader);
+
+/**
+ * Enable or disable live mode, in which reads also return the samples the DMA
+ * has already written into the period being filled.
+ */
+void ads1672_buf_set_live(struct ads1672_reader * reader, bool live);
+
+/**
+ * Set the number of samples which must be available before a blocking read or
+ * poll on this reader wakes up.
+ *
+ * \returns 0 on success or -EINVAL if avail_min is 0.
+ */
+int ads1672_buf_set_avail_min(struct ads1672_reader * reader, uint avail_min);
+
+/**
+ * Set the format in which samples are returned by ads1672_buf_readk() and
+ * ads1672_buf_read_iter() for this reader.
+ *	\param [in] reader	The reader to change.
+ *	\param [in] format	One of ::ADS1672_FORMAT.
+ *
+ * \returns 0 on success, -EBUSY if another thread is blocked reading from the
+ * reader or <0 on any other error.
+ */
+int ads1672_buf_set_format(struct ads1672_reader * reader, int format);
 
 /**
  * Read data from ADS1672 device, kernel version.
+ *	\param [in] reader	The reader whose cursor to read from.
  *	\param [out] out	A buffer in kernel space.
- *	\param [in] count	Maximum number of samples to read.
+ *	\param [in] len	Size of the buffer in bytes.
+ *	\param [in] nonblock	Fail with -EAGAIN rather than waiting for data.
+ *
+ * Samples are written in the reader's format, as many whole samples as fit in
+ * the buffer. The read continues across consecutive complete periods until the
+ * buffer is full, the next period is still being filled or the next period has
+ * a condition other than ADS1672_COND_OK. Only the first period is waited for.
+ *
+ * \returns number of bytes actually read or <0 on error, -EINVAL if the buffer
+ * cannot hold a single sample.
+ */
+ssize_t ads1672_buf_readk(struct ads1672_reader * reader, void * out,
+		size_t len, bool nonblock);
+
+/**
+ * Read data from ADS1672 device into an iterator.
+ *	\param [in] reader	The reader whose cursor to read from.
+ *	\param [out] to	Destination, usually user space buffers.
+ *	\param [in] nonblock	Fail with -EAGAIN rather than waiting for data or
+ *				for the reader lock.
+ *
+ * Reads as many whole samples as fit in the iterator. Samples are written in
+ * the reader's format and periods are crossed as for ads1672_buf_readk(). Data
+ * is copied using copy_to_iter, through a bounce buffer for formats other than
+ * ADS1672_FORMAT_S32.
  *
- * \returns number of samples actually read or <0 on error.
+ * \returns number of bytes actually read or <0 on error.
  */
-int ads1672_buf_readk(ads1672_sample_t * out, uint count);
+ssize_t ads1672_buf_read_iter(struct ads1672_reader * reader,
+		struct iov_iter * to, bool nonblock);
 
 /**
- * Read data from ADS1672 device, user space version.
- *	\param [out] out	A buffer in user space.
- *	\param [in] count	Maximum number of samples to read.
+ * Read up to max whole periods along with their status records.
+ *	\param [in] reader	The reader whose cursor is used.
+ *	\param [out] data	Buffer in user space with room for max periods.
+ *	\param [out] records	Array of max status records in user space.
+ *	\param [in] max	Maximum number of periods to read.
+ *	\param [in] nonblock	Fail with -EAGAIN rather than waiting for data.
  *
- * \returns number of samples actually read or <0 on error.
+ * Waits for the first period, then returns every complete period available.
+ * Conditions other than ADS1672_COND_OK are reported in the status records and
+ * cleared rather than failing the read.
  *
- * Data is copied using copy_to_user.
+ * \returns number of periods read or <0 on error.
  */
-int ads1672_buf_readu(ads1672_sample_t __user * out, uint count);
+int ads1672_buf_read_periods(struct ads1672_reader * reader,
+		ads1672_sample_t __user * data,
+		struct ads1672_period_status __user * records, uint max,
+		bool nonblock);
 
 /**
  * Complete the current period with the given condition and set the number of
  * valid samples as given.
+ *	\param [in] cond	Condition code of the period.
+ *	\param [in] nr_samples	Number of valid samples in the period.
+ *	\param [in] nr_lost	Number of samples lost to a DMA error.
+ *	\param [in] end	CLOCK_MONOTONIC_RAW time at which the period ended.
+ *
+ * Called in process context by the bottom half of the DMA callback, which is
+ * the only producer.
+ */
+void ads1672_buf_complete(struct ads1672_device * adc, int cond,
+		uint nr_samples, uint nr_lost, const struct timespec64 * end);
+
+/**
+ * Get the index of the period the DMA is filling.
  */
-void ads1672_buf_complete(int cond, uint nr_samples);
+uint ads1672_buf_get_write_period(struct ads1672_device * adc);
 
 /**
  * Discard remaining data in current buffer and perform flip.
  */
-void ads1672_buf_flush(void);
+void ads1672_buf_flush(struct ads1672_reader * reader);
+
+/**
+ * Wait for the current read period to be completed.
+ *	\param [in] reader	The reader whose cursor to wait on.
+ *	\param [out] pos	Position and condition of the reader.
+ *	\param [in] nonblock	Fail with -EAGAIN rather than waiting.
+ *
+ * \returns 0 on success or <0 on error.
+ */
+int ads1672_buf_wait(struct ads1672_reader * reader,
+		struct ads1672_position * pos, bool nonblock);
+
+/**
+ * Sleep until the reader's watermark is met, without taking the reader lock.
+ * This only peeks at the reader, so the caller must check it again under the
+ * lock afterwards.
+ *	\param [in] reader	The reader whose cursor to wait on.
+ *
+ * \returns 0 on success, -ETIMEDOUT if the read timeout expired or <0 if
+ * interrupted.
+ */
+int ads1672_buf_sleep(struct ads1672_reader * reader);
+
+/**
+ * Poll for a completed period, for use as the poll file operation.
+ */
+unsigned int ads1672_buf_poll(struct ads1672_reader * reader, struct file * f,
+		poll_table * wait);
+
+/**
+ * Release the current read period and move to the next one.
+ *
+ * \returns 0 on success or -EBUSY if the current read period is still being
+ * filled.
+ */
+int ads1672_buf_advance(struct ads1672_reader * reader);
+
+/**
+ * Move the read cursor forward to the start of the period with sequence number
+ * seq, discarding anything before it. Nothing is done if the cursor is already
+ * in that period.
+ *
+ * \returns 0 on success or -EINVAL if seq is behind the cursor or beyond the
+ * period being filled.
+ */
+int ads1672_buf_seek(struct ads1672_reader * reader, uint seq);
+
+/**
+ * Map the sample buffer or the status area into user space, depending on the
+ * offset of the mapping. Both are mapped read-only.
+ */
+int ads1672_buf_mmap(struct ads1672_device * adc,
+		struct vm_area_struct * vma);
 
 /**
  * Reset condition code to OK.
  */
-void ads1672_buf_clear_cond(void);
+void ads1672_buf_clear_cond(struct ads1672_reader * reader);
+
+/**
+ * Get the duration of nr_samples samples at the nominal sample rate.
+ *
+ * \returns the duration in nanoseconds.
+ */
+s64 ads1672_buf_samples_to_ns(uint nr_samples);
+
+/**
+ * Get the number of samples taken in a time at the nominal sample rate.
+ */
+uint ads1672_buf_ns_to_samples(s64 ns);
+
+/**
+ * Convert a time in nanoseconds to the form used in the user API.
+ */
+void ads1672_buf_ns_to_ts(s64 ns, struct __kernel_timespec * ts);
+
+/**
+ * Convert a time in the form used in the user API to nanoseconds.
+ */
+s64 ads1672_buf_ts_to_ns(const struct __kernel_timespec * ts);
+
+/**
+ * Get the sequence number of the period the DMA is filling, which is also the
+ * number of periods completed.
+ */
+uint ads1672_buf_get_write_seq(struct ads1672_device * adc);
+
+/**
+ * Publish the start of a capture in the status area.
+ *	\param [in] seq	Sequence number of the first period of the capture.
+ *	\param [in] ts	Time of the first sample, or NULL if it is not known.
+ *
+ * This must be called before the first period of the capture completes.
+ */
+void ads1672_buf_set_start(struct ads1672_device * adc, uint seq,
+		const struct __kernel_timespec * ts);
+
+/**
+ * Get the DMA address of the first period of the buffer.
+ */
+dma_addr_t ads1672_buf_get_dma_addr(struct ads1672_device * adc);
+
+/**
+ * Get the DMA address of the start of a period.
+ */
+dma_addr_t ads1672_buf_get_period_dma(struct ads1672_device * adc,
+		uint period);
 
 /**
- * Get the base DMA address of the buffer.
+ * Get the number of periods in each physically contiguous chunk of the buffer.
+ * This divides the number of periods, and equals it if the buffer is a single
+ * chunk.
  */
-dma_addr_t ads1672_buf_get_dma_addr(void);
+uint ads1672_buf_get_chunk_periods(struct ads1672_device * adc);
+
+/**
+ * Find the sample in the buffer at a DMA address.
+ *	\param [in] pos	The DMA address.
+ *	\param [out] index	Index of the sample from the start of the buffer.
+ *
+ * \returns 0 on success or -EINVAL if pos does not lie within the buffer.
+ */
+int ads1672_buf_find_dma(struct ads1672_device * adc, dma_addr_t pos,
+		uint * index);
 
 /**
  * Get the current condition value of the buffer.
  */
-int ads1672_buf_get_cond(void);
+int ads1672_buf_get_cond(struct ads1672_reader * reader);
+
+/**
+ * Get the time of the first valid sample in the reader's current period, or
+ * zero if the period has not yet completed.
+ */
+void ads1672_buf_get_timespec(struct ads1672_reader * reader,
+		struct __kernel_timespec * ts);
 
 /**
- * Get the current timespec of the buffer.
+ * Reallocate the buffer with a new period length and number of periods. Any
+ * data in the old buffer is discarded and the given reader is reset; there must
+ * be no other readers.
+ *
+ * The DMA transfer must be stopped and reprogrammed for the new buffer by the
+ * caller, which must hold the geometry_lock of the device.
+ *
+ * \returns 0 on success, -EBUSY if the buffer is mapped into user space or
+ * another thread is blocked reading from the reader, or another negative error
+ * code on failure, in which case the old buffer is left
+ * in place.
+ */
+int ads1672_buf_set_geometry(struct ads1672_reader * reader,
+		uint period_length, uint nr_periods);
+
+/**
+ * Get the time of an arbitrary sample.
+ *	\param [in] reader	The reader whose cursor to work relative to.
+ *	\param [in] index	Sample index, seq * period length + offset.
+ *	\param [out] ts	Time of the sample.
+ *
+ * The time is interpolated between the timestamps of the periods currently in
+ * the buffer, or extrapolated from them if the sample is no longer or not yet
+ * in the buffer.
+ *
+ * \returns 0 on success or -ENODATA if no period has completed yet.
  */
-void ads1672_buf_get_timespec(struct timespec * ts);
+int ads1672_buf_get_sample_time(struct ads1672_reader * reader, u64 index,
+		struct __kernel_timespec * ts);
 
 /**
- * Initialize buffering for an ADS1672 device.
+ * Initialize buffering for an ADS1672 device, with the geometry given by its
+ * period_length and nr_periods.
  */
-int ads1672_buf_init(void);
+int ads1672_buf_init(struct ads1672_device * adc);
 
 /**
  * Delete buffering for an ADS1672 device.
  */
-void ads1672_buf_exit(void);
+void ads1672_buf_exit(struct ads1672_device * adc);
 
 /**
- * The length of each period (or DMA frame).
+ * The default length of each period (or DMA frame) for every device.
  */
 extern uint ads1672_period_length;
 
 /**
- * The number of periods in the DMA buffer (or number of DMA frames).
+ * The default number of periods in the DMA buffer (or number of DMA frames)
+ * for every device.
  */
 extern uint ads1672_nr_periods;
 
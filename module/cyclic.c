@@ -0,0 +1,867 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * cyclic.c
+ * dmaengine capture backend for ads1672 driver.
+ *
+ * This implements the interface in mcbsp.h with cyclic and single period
+ * transfers through the generic dmaengine API. The serial port itself is not
+ * touched: it must be set up by the platform to present the samples of each
+ * device at its dma_src_addr with DMA requests enabled.
+ */
+
+#include <ads1672.h>
+#include <linux/dmaengine.h>
+#include <linux/kernel.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/string.h>
+#include <linux/time.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+#include "buffer.h"
+#include "device.h"
+#include "mcbsp.h"
+#include "ubuf.h"
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Name of the DMA channel for each device, for example "dma0chan3", or empty
+ * to take the first free channel capable of cyclic slave transfers.
+ */
+static char *			dma_channel[ADS1672_MAX_DEVICES] = {
+	"", "", "", "", ""
+};
+module_param_array(dma_channel, charp, NULL, S_IRUGO);
+
+/* Bus address of the data register the samples of each device are read from,
+ * by default the receive registers of McBSP1 to McBSP5 on the OMAP35xx.
+ */
+static ulong			dma_src_addr[ADS1672_MAX_DEVICES] = {
+	0x48074000, 0x49022000, 0x49024000, 0x49026000, 0x48096000
+};
+module_param_array(dma_src_addr, ulong, NULL, S_IRUGO);
+
+/* Receive FIFO threshold in samples. When non-zero each DMA
+ * request moves this many samples as one burst rather than one sample. The
+ * serial port must be set up by the platform to raise its requests at the
+ * same threshold. It must divide the period length. 0 uses a request for each
+ * sample.
+ */
+static uint			rx_threshold = 0;
+module_param(rx_threshold, uint, S_IRUGO);
+
+/* Completions are latched by the DMA callbacks into a ring of events and
+ * handled by a work item, so that the callbacks do as little as possible.
+ * ADS1672_NR_EVENTS must be a power of two.
+ */
+#define ADS1672_NR_EVENTS	32
+
+/* Number of single period transfers kept queued on the channel, see
+ * queue_periods(). When the buffer is in chunks the capture runs on these
+ * alone, so the callback must top the queue up before this many periods have
+ * gone by.
+ */
+#define ADS1672_QUEUE_DEPTH	4
+
+struct dma_event {
+	int			cond;
+	struct timespec64	ts;
+};
+
+struct ads1672_mcbsp;
+
+/* A transfer of a single period queued on the channel. */
+struct queued_period {
+	struct ads1672_mcbsp *	m;
+
+	/* Number of the transfer, counting from the start of the capture. */
+	uint			nr;
+
+	uint			period;
+	dma_addr_t		dest;
+	dma_cookie_t		cookie;
+};
+
+struct ads1672_mcbsp {
+	struct ads1672_device *		adc;
+
+	/* Allocated DMA channel */
+	struct dma_chan *		chan;
+
+	/* Cookie of the cyclic transfer. */
+	dma_cookie_t			cookie;
+
+	/* It's useful to keep track of the current status. */
+	int				status;
+
+	/* Serialises clearing ADS1672_STATUS_RUNNING on a stop against the
+	 * restart of the transfer after an error, so that a stopped channel is
+	 * never started again.
+	 */
+	struct mutex			lock;
+
+	/* Address of the kernel buffer, or 0 if it cannot be used. */
+	dma_addr_t			ring_dest;
+
+	/* Is the kernel buffer a single chunk, so that a cyclic transfer can
+	 * cover it?
+	 */
+	bool				contiguous;
+
+	/* Does the channel report the residue finely enough to locate the
+	 * DMA within a period? If not, each callback is taken to be a single
+	 * period and the live position is unavailable.
+	 */
+	bool				fine_residue;
+
+	/* Are we capturing into user buffers rather than the kernel buffer? */
+	bool				user_mode;
+
+	/* Everything from here to the events is shared between the
+	 * callbacks and whoever starts the transfer, and is protected by
+	 * dma_lock.
+	 */
+	spinlock_t			dma_lock;
+
+	/* Period the DMA is filling as of the last callback, so that the
+	 * periods between two callbacks are counted once whether or not the
+	 * driver merged their callbacks.
+	 */
+	uint				last_period;
+
+	/* A cyclic transfer always starts at the beginning of the ring. To
+	 * start anywhere else, the periods up to the end of the ring are
+	 * transferred one at a time, keeping ADS1672_QUEUE_DEPTH of them
+	 * queued, and the cyclic transfer is queued behind the last. If the
+	 * ring is in chunks there is no cyclic transfer and every period is
+	 * transferred on its own, moving from chunk to chunk. queued[]
+	 * is used in order: queue_head counts the transfers queued and
+	 * queue_tail those completed. next_period is the period to queue
+	 * next.
+	 */
+	struct queued_period		queued[ADS1672_QUEUE_DEPTH];
+	uint				queue_head;
+	uint				queue_tail;
+	uint				next_period;
+	bool				cyclic_queued;
+
+	struct dma_event		events[ADS1672_NR_EVENTS];
+	uint				event_head;
+	uint				event_tail;
+
+	/* End of the last period completed by the bottom half, from which the
+	 * time of a period whose event was lost is estimated.
+	 */
+	struct timespec64		last_ts;
+
+	struct workqueue_struct *	complete_wq;
+	struct work_struct		complete_work;
+};
+
+static void ads1672_cyclic_callback(void * param,
+		const struct dmaengine_result * result);
+static void ads1672_period_callback(void * param,
+		const struct dmaengine_result * result);
+
+static size_t ring_bytes(struct ads1672_mcbsp * m)
+{
+	return m->adc->nr_periods * m->adc->period_length *
+		sizeof(ads1672_sample_t);
+}
+
+static size_t period_bytes(struct ads1672_mcbsp * m)
+{
+	return m->adc->period_length * sizeof(ads1672_sample_t);
+}
+
+/* Offset in bytes from the start of the ring which the cyclic transfer will
+ * write next, or -1 if it cannot be found.
+ */
+static long dma_offset(struct ads1672_mcbsp * m)
+{
+	struct dma_tx_state state;
+	enum dma_status s;
+
+	s = dmaengine_tx_status(m->chan, m->cookie, &state);
+	if (s == DMA_ERROR || state.residue == 0 ||
+			state.residue > ring_bytes(m))
+		return -1;
+
+	return ring_bytes(m) - state.residue;
+}
+
+/* DMA address the channel will write next, or 0 if it cannot be found. */
+static dma_addr_t dst_pos(struct ads1672_mcbsp * m)
+{
+	struct queued_period * q;
+	struct dma_tx_state state;
+	unsigned long flags;
+	dma_addr_t pos = 0;
+	enum dma_status s;
+	long offset;
+
+	if (!m->fine_residue)
+		return 0;
+
+	spin_lock_irqsave(&m->dma_lock, flags);
+
+	if (m->queue_tail != m->queue_head) {
+		q = &m->queued[m->queue_tail % ADS1672_QUEUE_DEPTH];
+		s = dmaengine_tx_status(m->chan, q->cookie, &state);
+		if (s != DMA_ERROR && state.residue != 0 &&
+				state.residue <= period_bytes(m))
+			pos = q->dest + period_bytes(m) - state.residue;
+	} else if (m->cyclic_queued) {
+		offset = dma_offset(m);
+		if (offset >= 0)
+			pos = m->ring_dest + offset;
+	}
+
+	spin_unlock_irqrestore(&m->dma_lock, flags);
+	return pos;
+}
+
+/* Latch the completion of a period for the bottom half. Called with dma_lock
+ * held.
+ */
+static void push_event(struct ads1672_mcbsp * m, int cond,
+		const struct timespec64 * ts)
+{
+	struct dma_event * ev = &m->events[m->event_head &
+		(ADS1672_NR_EVENTS - 1)];
+
+	ev->cond = cond;
+	ev->ts = *ts;
+	smp_store_release(&m->event_head, m->event_head + 1);
+}
+
+/* Prepare and submit a cyclic transfer over the whole ring. Called with
+ * dma_lock held.
+ */
+static int submit_cyclic(struct ads1672_mcbsp * m)
+{
+	struct dma_async_tx_descriptor * desc;
+
+	desc = dmaengine_prep_dma_cyclic(m->chan, m->ring_dest, ring_bytes(m),
+			period_bytes(m), DMA_DEV_TO_MEM, DMA_PREP_INTERRUPT);
+	if (!desc)
+		return -ENOMEM;
+
+	desc->callback_result = ads1672_cyclic_callback;
+	desc->callback_param = m;
+
+	m->cookie = dmaengine_submit(desc);
+	if (dma_submit_error(m->cookie))
+		return -EIO;
+
+	m->cyclic_queued = true;
+	return 0;
+}
+
+/* Prepare and submit a transfer of a single period to dest. Called with
+ * dma_lock held.
+ */
+static int submit_period(struct ads1672_mcbsp * m, uint period,
+		dma_addr_t dest)
+{
+	struct queued_period * q = &m->queued[m->queue_head %
+		ADS1672_QUEUE_DEPTH];
+	struct dma_async_tx_descriptor * desc;
+
+	desc = dmaengine_prep_slave_single(m->chan, dest, period_bytes(m),
+			DMA_DEV_TO_MEM, DMA_PREP_INTERRUPT);
+	if (!desc)
+		return -ENOMEM;
+
+	q->m = m;
+	q->nr = m->queue_head;
+	q->period = period;
+	q->dest = dest;
+
+	desc->callback_result = ads1672_period_callback;
+	desc->callback_param = q;
+
+	q->cookie = dmaengine_submit(desc);
+	if (dma_submit_error(q->cookie))
+		return -EIO;
+
+	m->queue_head++;
+	return 0;
+}
+
+/* Keep the queue of single period transfers topped up until the end of the
+ * ring, then queue the cyclic transfer behind them if the ring is contiguous.
+ * Called with dma_lock held.
+ */
+static int queue_periods(struct ads1672_mcbsp * m)
+{
+	int r = 0;
+
+	while (!m->cyclic_queued &&
+			m->queue_head - m->queue_tail < ADS1672_QUEUE_DEPTH) {
+		if (m->contiguous && m->next_period == 0) {
+			r = submit_cyclic(m);
+			break;
+		}
+
+		r = submit_period(m, m->next_period,
+				ads1672_buf_get_period_dma(m->adc,
+					m->next_period));
+		if (r < 0)
+			break;
+
+		m->next_period = (m->next_period + 1) % m->adc->nr_periods;
+	}
+
+	dma_async_issue_pending(m->chan);
+	return r;
+}
+
+/* Start the DMA into the kernel buffer at the given period. The channel must
+ * be idle.
+ */
+static int start_transfer(struct ads1672_mcbsp * m, uint period)
+{
+	int r;
+
+	spin_lock_irq(&m->dma_lock);
+
+	m->last_period = period;
+	m->next_period = period;
+	m->queue_head = 0;
+	m->queue_tail = 0;
+	m->cyclic_queued = false;
+	r = queue_periods(m);
+
+	spin_unlock_irq(&m->dma_lock);
+	return r;
+}
+
+/* Recover from a transfer error. The transfer is torn down and started again
+ * at the period after the one in error, which alone is completed as an error.
+ * Periods the DMA went on to fill before it was torn down are filled again.
+ *
+ * Returns the number of samples lost: those the DMA had written since the start
+ * of the period in error and those it missed while restarting. Sets *head to
+ * the event count once the failed transfer has been torn down.
+ */
+static uint recover(struct ads1672_mcbsp * m, const struct timespec64 * err_ts,
+		uint * head)
+{
+	struct ads1672_device * adc = m->adc;
+	uint period = ads1672_buf_get_write_period(adc);
+	uint ring = adc->nr_periods * adc->period_length;
+	uint written = 0;
+	struct timespec64 now;
+	uint nr_lost;
+	uint index;
+
+	if (ads1672_buf_find_dma(adc, dst_pos(m), &index) == 0)
+		written = (index + ring - period * adc->period_length) % ring;
+
+	dmaengine_terminate_sync(m->chan);
+	*head = smp_load_acquire(&m->event_head);
+
+	if (start_transfer(m, (period + 1) % adc->nr_periods) < 0) {
+		printk(KERN_ERR "ads1672.%u: Failed to restart DMA\n",
+				adc->index);
+		m->status &= ~ADS1672_STATUS_RUNNING;
+	}
+	ktime_get_raw_ts64(&now);
+
+	nr_lost = written + ads1672_buf_ns_to_samples(timespec64_to_ns(&now) -
+			timespec64_to_ns(err_ts));
+
+	ads1672_buf_complete(adc, ADS1672_COND_DMA_ERROR, 0, nr_lost, err_ts);
+	return nr_lost;
+}
+
+/* Bottom half of the DMA callbacks, run from complete_wq. */
+static void complete_work_fn(struct work_struct * work)
+{
+	struct ads1672_mcbsp * m = container_of(work, struct ads1672_mcbsp,
+			complete_work);
+	struct dma_event ev;
+	uint head = smp_load_acquire(&m->event_head);
+	uint tail = m->event_tail;
+	uint nr_samples;
+	uint nr_lost;
+	bool restarted;
+	bool lost_status;
+
+	while (tail != head) {
+		ev = m->events[tail & (ADS1672_NR_EVENTS - 1)];
+
+		/* If we fell so far behind that the callbacks have reused the
+		 * event, or may be reusing it as we copy it, its status is
+		 * lost. The callbacks write the event before publishing it,
+		 * so check against event_head as it is after the copy.
+		 */
+		smp_rmb();
+		lost_status = READ_ONCE(m->event_head) - tail >=
+			ADS1672_NR_EVENTS;
+		tail++;
+
+		if (lost_status) {
+			printk_ratelimited(KERN_ERR "ads1672.%u: Lost status "
+					"of a period\n", m->adc->index);
+			ev.ts = ns_to_timespec64(timespec64_to_ns(&m->last_ts) +
+					ads1672_buf_samples_to_ns(
+						m->adc->period_length));
+			m->last_ts = ev.ts;
+			ads1672_buf_complete(m->adc, ADS1672_COND_STATUS_LOST,
+					m->adc->period_length, 0, &ev.ts);
+			continue;
+		}
+
+		m->last_ts = ev.ts;
+
+		restarted = false;
+		if (ev.cond != ADS1672_COND_OK) {
+			mutex_lock(&m->lock);
+			restarted = m->status & ADS1672_STATUS_RUNNING;
+			if (restarted)
+				nr_lost = recover(m, &ev.ts, &head);
+			mutex_unlock(&m->lock);
+		}
+
+		if (restarted) {
+			tail = head;
+			printk(KERN_ERR "ads1672.%u: Transfer error, restarted "
+					"losing %u samples\n", m->adc->index,
+					nr_lost);
+			continue;
+		}
+
+		if (ev.cond != ADS1672_COND_OK)
+			printk(KERN_ERR "ads1672.%u: Transfer error\n",
+					m->adc->index);
+
+		nr_samples = (ev.cond == ADS1672_COND_OK) ?
+			m->adc->period_length : 0;
+		ads1672_buf_complete(m->adc, ev.cond, nr_samples, 0, &ev.ts);
+	}
+
+	m->event_tail = tail;
+}
+
+static int result_cond(const struct dmaengine_result * result)
+{
+	return (result && result->result != DMA_TRANS_NOERROR) ?
+		ADS1672_COND_DMA_ERROR : ADS1672_COND_OK;
+}
+
+/* Complete a period captured into a user buffer and queue the destination
+ * after the one the DMA has moved on to. This is done in the callback itself
+ * rather than the bottom half, so that the channel does not run dry. The
+ * channel carries on with the queued transfer after an error, so there is
+ * nothing to recover.
+ */
+static void complete_user(struct ads1672_mcbsp * m, int cond,
+		const struct timespec64 * end)
+{
+	unsigned long flags;
+	dma_addr_t dest;
+	int r;
+
+	dest = ads1672_ubuf_complete(m->adc, cond, (cond == ADS1672_COND_OK) ?
+			m->adc->period_length : 0, end);
+
+	spin_lock_irqsave(&m->dma_lock, flags);
+
+	m->queue_tail++;
+	r = submit_period(m, 0, dest);
+	if (r == 0)
+		dma_async_issue_pending(m->chan);
+
+	spin_unlock_irqrestore(&m->dma_lock, flags);
+
+	if (r < 0)
+		printk_ratelimited(KERN_ERR "ads1672.%u: Failed to queue DMA\n",
+				m->adc->index);
+}
+
+/* Callback of a single period transfer, called from the DMA driver's tasklet.
+ * The queue is topped up from here so that it cannot run dry while waiting for
+ * the bottom half. After an error nothing more is queued and the bottom half
+ * restarts the transfer.
+ */
+static void ads1672_period_callback(void * param,
+		const struct dmaengine_result * result)
+{
+	struct queued_period * q = param;
+	struct ads1672_mcbsp * m = q->m;
+	struct timespec64 now;
+	unsigned long flags;
+	int cond;
+
+	/* Timestamp the end of the period before doing anything else. */
+	ktime_get_raw_ts64(&now);
+	cond = result_cond(result);
+
+	/* Capture only changes mode while stopped. */
+	if (m->user_mode) {
+		complete_user(m, cond, &now);
+		return;
+	}
+
+	spin_lock_irqsave(&m->dma_lock, flags);
+
+	/* The callback of the cyclic transfer may have run first and counted
+	 * this period already, see below.
+	 */
+	if (q->nr != m->queue_tail) {
+		spin_unlock_irqrestore(&m->dma_lock, flags);
+		return;
+	}
+
+	m->queue_tail++;
+	m->last_period = (q->period + 1) % m->adc->nr_periods;
+	push_event(m, cond, &now);
+
+	if (cond == ADS1672_COND_OK && queue_periods(m) < 0)
+		printk_ratelimited(KERN_ERR "ads1672.%u: Failed to queue DMA\n",
+				m->adc->index);
+
+	spin_unlock_irqrestore(&m->dma_lock, flags);
+
+	queue_work(m->complete_wq, &m->complete_work);
+}
+
+/* Callback of the cyclic transfer, called from the DMA driver's tasklet for
+ * each period completed.
+ *
+ * Callbacks for several periods may be merged into one if the tasklet is held
+ * off, so when the channel reports the residue finely enough the periods
+ * completed are counted from the position of the DMA since the last callback.
+ * A callback for a period which an earlier one has already counted then counts
+ * nothing. Otherwise each callback counts as one period.
+ *
+ * The cyclic transfer only starts once every single period transfer queued
+ * ahead of it has completed, but the driver may run this callback before
+ * theirs, so any still outstanding are counted here.
+ */
+static void ads1672_cyclic_callback(void * param,
+		const struct dmaengine_result * result)
+{
+	struct ads1672_mcbsp * m = param;
+	struct timespec64 now;
+	struct timespec64 ts;
+	unsigned long flags;
+	uint nr_periods;
+	uint period;
+	uint past = 0;
+	long offset = -1;
+	int cond;
+	uint i;
+
+	/* Timestamp the end of the period before doing anything else. */
+	ktime_get_raw_ts64(&now);
+	cond = result_cond(result);
+
+	spin_lock_irqsave(&m->dma_lock, flags);
+
+	nr_periods = m->queue_head - m->queue_tail;
+	if (nr_periods) {
+		m->queue_tail = m->queue_head;
+		m->last_period = 0;
+	}
+
+	if (m->fine_residue && cond == ADS1672_COND_OK)
+		offset = dma_offset(m);
+
+	if (offset >= 0) {
+		period = offset / period_bytes(m);
+		past = (offset % period_bytes(m)) / sizeof(ads1672_sample_t);
+		nr_periods += (period + m->adc->nr_periods - m->last_period) %
+			m->adc->nr_periods;
+		m->last_period = period;
+	} else {
+		nr_periods++;
+	}
+
+	/* Back-date merged periods from the position of the DMA. Only the
+	 * last can have failed.
+	 */
+	for (i = 0; i < nr_periods; i++) {
+		ts = ns_to_timespec64(timespec64_to_ns(&now) -
+				ads1672_buf_samples_to_ns(past +
+					(nr_periods - 1 - i) *
+					m->adc->period_length));
+		push_event(m, i == nr_periods - 1 ? cond : ADS1672_COND_OK,
+				&ts);
+	}
+
+	spin_unlock_irqrestore(&m->dma_lock, flags);
+
+	if (nr_periods)
+		queue_work(m->complete_wq, &m->complete_work);
+}
+
+/* A cyclic transfer covers a single contiguous buffer. A buffer in chunks is
+ * filled a period at a time instead.
+ */
+static int set_ring(struct ads1672_mcbsp * m)
+{
+	struct ads1672_device * adc = m->adc;
+
+	m->contiguous = ads1672_buf_get_chunk_periods(adc) == adc->nr_periods;
+	m->ring_dest = ads1672_buf_get_dma_addr(adc);
+	return 0;
+}
+
+static bool filter(struct dma_chan * c, void * param)
+{
+	const char * name = param;
+
+	return !name || !name[0] || !strcmp(dma_chan_name(c), name);
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+void ads1672_mcbsp_start(struct ads1672_device * adc)
+{
+	struct ads1672_mcbsp * m = adc->mcbsp;
+	int r;
+
+	if (!m->ring_dest)
+		return;
+
+	/* Carry on from the period after the last stop. */
+	ktime_get_raw_ts64(&m->last_ts);
+	r = start_transfer(m, ads1672_buf_get_write_period(adc));
+	if (r < 0) {
+		printk(KERN_ERR "ads1672.%u: Error %d starting DMA\n",
+				adc->index, r);
+		dmaengine_terminate_sync(m->chan);
+		return;
+	}
+
+	m->status |= ADS1672_STATUS_RUNNING;
+
+	printk(KERN_ALERT "ads1672.%u: Started\n", adc->index);
+}
+
+int ads1672_mcbsp_start_user(struct ads1672_device * adc, dma_addr_t first,
+		dma_addr_t second)
+{
+	struct ads1672_mcbsp * m = adc->mcbsp;
+	int r;
+
+	/* Transfer each period on its own so that the destination can change
+	 * from one period to the next. Two are kept queued, the one being
+	 * filled and the one after it.
+	 */
+	m->user_mode = true;
+
+	spin_lock_irq(&m->dma_lock);
+
+	m->queue_head = 0;
+	m->queue_tail = 0;
+	m->cyclic_queued = false;
+	r = submit_period(m, 0, first);
+	if (r == 0)
+		r = submit_period(m, 0, second);
+	if (r == 0)
+		dma_async_issue_pending(m->chan);
+
+	spin_unlock_irq(&m->dma_lock);
+
+	if (r < 0) {
+		printk(KERN_ERR "ads1672.%u: Error %d starting DMA\n",
+				adc->index, r);
+		dmaengine_terminate_sync(m->chan);
+		m->user_mode = false;
+		return r;
+	}
+
+	m->status |= ADS1672_STATUS_RUNNING;
+
+	printk(KERN_ALERT "ads1672.%u: Started into user buffers\n",
+			adc->index);
+	return 0;
+}
+
+void ads1672_mcbsp_stop(struct ads1672_device * adc)
+{
+	struct ads1672_mcbsp * m = adc->mcbsp;
+
+	/* Stop the completion work restarting the transfer. A restart which
+	 * is already under way finishes before we terminate it.
+	 */
+	mutex_lock(&m->lock);
+	m->status &= ~ADS1672_STATUS_RUNNING;
+	mutex_unlock(&m->lock);
+
+	if (m->chan)
+		dmaengine_terminate_sync(m->chan);
+
+	/* Finish handling any completions from before the stop. */
+	if (m->complete_wq)
+		flush_workqueue(m->complete_wq);
+
+	/* The kernel buffer is set up again on the next start. */
+	m->user_mode = false;
+
+	printk(KERN_ALERT "ads1672.%u: Stopped\n", adc->index);
+}
+
+int ads1672_mcbsp_status(struct ads1672_device * adc)
+{
+	/* The interface is only set up while the device is in use. */
+	return adc->mcbsp ? adc->mcbsp->status : 0;
+}
+
+dma_addr_t ads1672_mcbsp_get_dst_pos(struct ads1672_device * adc)
+{
+	struct ads1672_mcbsp * m = adc->mcbsp;
+
+	if (!m || !(m->status & ADS1672_STATUS_RUNNING) || m->user_mode)
+		return 0;
+
+	return dst_pos(m);
+}
+
+int ads1672_mcbsp_check_geometry(struct ads1672_device * adc,
+		uint period_length, uint nr_periods)
+{
+	struct dma_chan * chan = adc->mcbsp ? adc->mcbsp->chan : NULL;
+
+	/* Each period is a segment of the cyclic transfer, or a transfer of its
+	 * own.
+	 */
+	if (chan && period_length * sizeof(ads1672_sample_t) >
+			dma_get_max_seg_size(chan->device->dev))
+		return -EINVAL;
+
+	/* Bursts must not straddle the end of a period. */
+	if (rx_threshold && period_length % rx_threshold)
+		return -EINVAL;
+
+	return 0;
+}
+
+int ads1672_mcbsp_reconfigure(struct ads1672_device * adc)
+{
+	if (adc->mcbsp->status & ADS1672_STATUS_RUNNING)
+		return -EBUSY;
+
+	return set_ring(adc->mcbsp);
+}
+
+int ads1672_mcbsp_init(struct ads1672_device * adc)
+{
+	struct ads1672_mcbsp * m;
+	struct dma_slave_config config;
+	struct dma_slave_caps caps;
+	dma_cap_mask_t mask;
+	int r;
+
+	/* Everything set up from here on is undone by ads1672_mcbsp_exit(). */
+	m = kzalloc(sizeof(*m), GFP_KERNEL);
+	if (!m)
+		return -ENOMEM;
+
+	m->adc = adc;
+	mutex_init(&m->lock);
+	spin_lock_init(&m->dma_lock);
+	INIT_WORK(&m->complete_work, complete_work_fn);
+	adc->mcbsp = m;
+
+	m->complete_wq = alloc_ordered_workqueue("ads1672.%u", WQ_HIGHPRI,
+			adc->index);
+	if (!m->complete_wq)
+		return -ENOMEM;
+
+	dma_cap_zero(mask);
+	dma_cap_set(DMA_SLAVE, mask);
+	dma_cap_set(DMA_CYCLIC, mask);
+
+	m->chan = dma_request_channel(mask, filter, dma_channel[adc->index]);
+	if (!m->chan) {
+		printk(KERN_ERR "ads1672.%u: No cyclic DMA channel available\n",
+				adc->index);
+		return -ENODEV;
+	}
+
+	memset(&config, 0, sizeof(config));
+	config.direction = DMA_DEV_TO_MEM;
+	config.src_addr = dma_src_addr[adc->index];
+	config.src_addr_width = DMA_SLAVE_BUSWIDTH_4_BYTES;
+	config.src_maxburst = rx_threshold ? rx_threshold : 1;
+
+	memset(&caps, 0, sizeof(caps));
+	r = dma_get_slave_caps(m->chan, &caps);
+	m->fine_residue = r == 0 &&
+		caps.residue_granularity != DMA_RESIDUE_GRANULARITY_DESCRIPTOR;
+
+	if (r == 0 && caps.max_burst && config.src_maxburst > caps.max_burst) {
+		printk(KERN_ERR "ads1672.%u: Receive threshold %u too large\n",
+				adc->index, rx_threshold);
+		return -EINVAL;
+	}
+
+	r = dmaengine_slave_config(m->chan, &config);
+	if (r < 0)
+		return r;
+
+	r = ads1672_mcbsp_check_geometry(adc, adc->period_length,
+			adc->nr_periods);
+	if (r < 0)
+		return r;
+
+	r = set_ring(m);
+	if (r < 0)
+		return r;
+
+	m->status |= ADS1672_STATUS_READY;
+
+	printk(KERN_INFO "ads1672.%u: Using DMA channel %s\n", adc->index,
+			dma_chan_name(m->chan));
+	return 0;
+}
+
+void ads1672_mcbsp_exit(struct ads1672_device * adc)
+{
+	struct ads1672_mcbsp * m = adc->mcbsp;
+
+	if (!m)
+		return;
+
+	/* Ensure device is stopped. */
+	if (m->status & ADS1672_STATUS_RUNNING)
+		ads1672_mcbsp_stop(adc);
+
+	if (m->chan)
+		dma_release_channel(m->chan);
+
+	if (m->complete_wq)
+		destroy_workqueue(m->complete_wq);
+
+	kfree(m);
+	adc->mcbsp = NULL;
+}
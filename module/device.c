@@ -22,47 +22,78 @@
  */
 
 #include <ads1672.h>
+#include <linux/atomic.h>
 #include <linux/fs.h>
 #include <linux/cdev.h>
+#include <linux/device.h>
+#include <linux/dma-mapping.h>
+#include <linux/err.h>
 #include <linux/ioctl.h>
 #include <linux/module.h>
+#include <linux/mutex.h>
 #include <linux/platform_device.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/splice.h>
+#include <linux/uio.h>
+#include <linux/version.h>
 
 #include "buffer.h"
 #include "device.h"
+#include "format.h"
+#include "gang.h"
 #include "gpio.h"
 #include "mcbsp.h"
+#include "module.h"
+#include "trigger.h"
+#include "ubuf.h"
 
 /*******************************************************************************
 	Private declarations and data.
 *******************************************************************************/
 
 /* Handle read operation on an ADS1672 device. */
-static ssize_t ads1672_read(struct file *f,
-			    char __user *buf,
-			    size_t count,
-			    loff_t *offp);
+static ssize_t ads1672_read_iter(struct kiocb *iocb, struct iov_iter *to);
 
 /* Handle ioctl operation on an ADS1672 device. */
 static long ads1672_ioctl(struct file *f,
 			  unsigned int cmd,
 			  unsigned long arg);
 
+/* Handle poll operation on an ADS1672 device. */
+static unsigned int ads1672_poll(struct file *f, poll_table *wait);
+
+/* Handle mmap operation on an ADS1672 device. */
+static int ads1672_mmap(struct file *f, struct vm_area_struct *vma);
+
 /* Handle open operation on an ADS1672 device. */
 static int ads1672_open(struct inode *inode, struct file *f);
 
 /* Handle close operation on an ADS1672 device. */
 static int ads1672_release(struct inode *inode, struct file *f);
 
-static struct cdev		cdev;
-static struct platform_device	plat;
+/* Class of the device nodes, /dev/ads1672.N. */
+static struct class *		ads1672_class = NULL;
 
 /* Declare file operations for ADS1672 device. */
 static struct file_operations fops = {
 	.owner		= THIS_MODULE,
+#if LINUX_VERSION_CODE < KERNEL_VERSION(6, 12, 0)
 	.llseek		= no_llseek,
-	.read		= ads1672_read,
+#endif
+	.read_iter	= ads1672_read_iter,
+	/* Splice goes through read_iter, which only consumes samples once
+	 * they have been copied into pages the pipe has room for.
+	 */
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 5, 0)
+	.splice_read	= copy_splice_read,
+#else
+	.splice_read	= generic_file_splice_read,
+#endif
 	.unlocked_ioctl	= ads1672_ioctl,
+	.compat_ioctl	= compat_ptr_ioctl,
+	.poll		= ads1672_poll,
+	.mmap		= ads1672_mmap,
 	.open		= ads1672_open,
 	.release	= ads1672_release,
 };
@@ -71,121 +102,436 @@ static struct file_operations fops = {
 static int			major = 0;
 module_param(major, int, S_IRUGO);
 
-/* Device minor number. */
+/* Device minor number of the first device, the others follow it. */
 static int			minor = 0;
 module_param(minor, int, S_IRUGO);
 
+/* The device being accessed through an open file. */
+static struct ads1672_device * file_adc(struct file *f)
+{
+	return container_of(file_inode(f)->i_cdev, struct ads1672_device,
+			cdev);
+}
+
+/* The device a sysfs attribute belongs to. */
+static struct ads1672_device * dev_adc(struct device *dev)
+{
+	return container_of(to_platform_device(dev), struct ads1672_device,
+			plat);
+}
+
 /*******************************************************************************
 	Private functions.
 *******************************************************************************/
 
-static ssize_t ads1672_read(struct file *f,
-			    char __user *buf,
-			    size_t count,
-			    loff_t *offp)
+static ssize_t ads1672_read_iter(struct kiocb *iocb, struct iov_iter *to)
 {
+	struct file *f = iocb->ki_filp;
+	struct ads1672_reader *reader = f->private_data;
+	bool nonblock;
+
+	/* IOCB_NOWAIT lets io_uring and AIO try the read inline, falling back
+	 * to poll if no data is ready rather than blocking a worker thread.
+	 */
+	nonblock = (iocb->ki_flags & IOCB_NOWAIT) || (f->f_flags & O_NONBLOCK);
+
+	/* A ganged file reads frames from all of its devices. */
+	if (reader->gang)
+		return ads1672_gang_read_iter(reader, to, nonblock);
+
+	return ads1672_buf_read_iter(reader, to, nonblock);
+}
+
+static int ads1672_start_locked(struct ads1672_device *adc, struct file *f)
+{
+	dma_addr_t first, second;
 	int r;
 
-	r = ads1672_buf_readu((ads1672_sample_t __user *)buf, count/sizeof(ads1672_sample_t));
+	if (!ads1672_ubuf_active(adc)) {
+		/* Starting again would reprogram the live channel, so a
+		 * second START leaves the capture running as it is.
+		 */
+		if (ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING)
+			return 0;
+
+		ads1672_mcbsp_start(adc);
 
-	/*
-		Return value of ads1672_buf_readu is in samples not bytes but we
-		don't want to multiply an error code.
-	*/
+		/* Only ads1672_trigger_start() knows when the first sample
+		 * was taken.
+		 */
+		ads1672_buf_set_start(adc, ads1672_buf_get_write_seq(adc),
+				NULL);
+		return 0;
+	}
+
+	/* Once user buffers are registered, capture goes into them and only
+	 * their owner may start it.
+	 */
+	if (!ads1672_ubuf_is_owner(adc, f))
+		return -EBUSY;
+	if (ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING)
+		return -EBUSY;
+
+	r = ads1672_ubuf_prepare(adc, &first, &second);
 	if (r < 0)
 		return r;
-	else
-		return r * sizeof(int);
+
+	r = ads1672_mcbsp_start_user(adc, first, second);
+	if (r < 0)
+		ads1672_ubuf_stop(adc);
+	return r;
+}
+
+static int ads1672_set_geometry(struct ads1672_device *adc, struct file *f,
+				const struct ads1672_geometry *g)
+{
+	int r;
+
+	mutex_lock(&adc->geometry_lock);
+
+	/* The buffer can only be replaced while nothing else could be using
+	 * it: the transfer must be stopped and the caller must hold the only
+	 * open file handle. User buffers are sized for the current geometry so
+	 * they must be released first.
+	 */
+	if ((ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING) ||
+			atomic_read(&adc->open_count) > 1 ||
+			ads1672_ubuf_active(adc)) {
+		r = -EBUSY;
+		goto out;
+	}
+
+	r = ads1672_mcbsp_check_geometry(adc, g->period_length,
+			g->nr_periods);
+	if (r < 0)
+		goto out;
+
+	r = ads1672_buf_set_geometry(f->private_data, g->period_length,
+			g->nr_periods);
+	if (r < 0)
+		goto out;
+
+	r = ads1672_mcbsp_reconfigure(adc);
+
+out:
+	mutex_unlock(&adc->geometry_lock);
+	return r;
 }
 
 static long ads1672_ioctl(struct file *f,
 			  unsigned int cmd,
 			  unsigned long arg)
 {
+	struct ads1672_device *adc = file_adc(f);
+	struct ads1672_reader *reader = f->private_data;
+
 	switch (cmd) {
 		case ADS1672_IOCTL_START:
-			ads1672_mcbsp_start();
-			return 0;
+			if (reader->gang)
+				return ads1672_gang_start(reader);
+			return ads1672_start(adc, f);
 
 		case ADS1672_IOCTL_STOP:
-			ads1672_mcbsp_stop();
+			if (reader->gang)
+				ads1672_gang_stop(reader);
+			else
+				ads1672_stop(adc);
 			return 0;
 
 		case ADS1672_IOCTL_GPIO_START_SET:
 		{
-			int * status = (int *)arg;
-			if (!access_ok(VERIFY_READ, status, sizeof(*status)))
-				return -EINVAL;
-			ads1672_gpio_start_set(*status);
+			int status;
+			if (get_user(status, (int __user *)arg))
+				return -EFAULT;
+			ads1672_gpio_start_set(adc, status);
 			return 0;
 		}
 		case ADS1672_IOCTL_GPIO_START_GET:
+			return put_user(ads1672_gpio_start_get(adc),
+					(int __user *)arg);
+
+		case ADS1672_IOCTL_GPIO_SELECT_SET:
 		{
-			int * status = (int *)arg;
-			if (!access_ok(VERIFY_WRITE, status, sizeof(*status)))
-				return -EINVAL;
-			*status = ads1672_gpio_start_get();
+			int status;
+			if (get_user(status, (int __user *)arg))
+				return -EFAULT;
+			ads1672_gpio_select_set(adc, status);
 			return 0;
 		}
-		case ADS1672_IOCTL_GPIO_SELECT_SET:
+		case ADS1672_IOCTL_GPIO_SELECT_GET:
+			return put_user(ads1672_gpio_select_get(adc),
+					(int __user *)arg);
+
+		case ADS1672_IOCTL_CLEAR_CONDITION:
+			if (reader->gang)
+				ads1672_gang_clear_cond(reader);
+			else
+				ads1672_buf_clear_cond(reader);
+			return 0;
+
+		case ADS1672_IOCTL_GET_TIMESPEC:
 		{
-			int * status = (int *)arg;
-			if (!access_ok(VERIFY_READ, status, sizeof(*status)))
-				return -EINVAL;
-			ads1672_gpio_select_set(*status);
+			struct __kernel_timespec ts;
+			ads1672_buf_get_timespec(reader, &ts);
+			if (copy_to_user((void __user *)arg, &ts, sizeof(ts)))
+				return -EFAULT;
 			return 0;
 		}
-		case ADS1672_IOCTL_GPIO_SELECT_GET:
+		case ADS1672_IOCTL_GET_CONDITION:
+		{
+			int cond;
+			if (reader->gang)
+				cond = ads1672_gang_get_cond(reader);
+			else
+				cond = ads1672_buf_get_cond(reader);
+			return put_user(cond, (int __user *)arg);
+		}
+		case ADS1672_IOCTL_WAIT_PERIOD:
+		{
+			int r;
+			struct ads1672_position pos;
+			if (reader->gang)
+				return -EBUSY;
+			r = ads1672_buf_wait(reader, &pos, f->f_flags & O_NONBLOCK);
+			if (r < 0)
+				return r;
+			if (copy_to_user((void __user *)arg, &pos, sizeof(pos)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADS1672_IOCTL_ADVANCE:
+			if (reader->gang)
+				return -EBUSY;
+			return ads1672_buf_advance(reader);
+
+		case ADS1672_IOCTL_GET_GEOMETRY:
+		{
+			struct ads1672_geometry g;
+			g.period_length = adc->period_length;
+			g.nr_periods = adc->nr_periods;
+			if (copy_to_user((void __user *)arg, &g, sizeof(g)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADS1672_IOCTL_GET_SAMPLE_TIME:
+		{
+			int r;
+			struct ads1672_sample_time st;
+			if (copy_from_user(&st, (void __user *)arg, sizeof(st)))
+				return -EFAULT;
+			r = ads1672_buf_get_sample_time(reader, st.index, &st.ts);
+			if (r < 0)
+				return r;
+			if (copy_to_user((void __user *)arg, &st, sizeof(st)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADS1672_IOCTL_SET_GEOMETRY:
+		{
+			struct ads1672_geometry g;
+			if (copy_from_user(&g, (void __user *)arg, sizeof(g)))
+				return -EFAULT;
+			return ads1672_set_geometry(adc, f, &g);
+		}
+		case ADS1672_IOCTL_SET_FORMAT:
+		{
+			int format;
+			if (get_user(format, (int __user *)arg))
+				return -EFAULT;
+			return ads1672_buf_set_format(reader, format);
+		}
+		case ADS1672_IOCTL_GET_FORMAT:
+			return put_user(reader->format, (int __user *)arg);
+		case ADS1672_IOCTL_READ_PERIODS:
 		{
-			int * status = (int *)arg;
-			if (!access_ok(VERIFY_WRITE, status, sizeof(*status)))
+			int r;
+			struct ads1672_batch b;
+			if (reader->gang)
+				return -EBUSY;
+			if (copy_from_user(&b, (void __user *)arg, sizeof(b)))
+				return -EFAULT;
+			if (b.reserved)
 				return -EINVAL;
-			*status = ads1672_gpio_select_get();
+			r = ads1672_buf_read_periods(reader,
+					u64_to_user_ptr(b.data),
+					u64_to_user_ptr(b.status),
+					b.nr_periods, f->f_flags & O_NONBLOCK);
+			if (r < 0)
+				return r;
+			b.nr_periods = r;
+			if (copy_to_user((void __user *)arg, &b, sizeof(b)))
+				return -EFAULT;
 			return 0;
 		}
-		case ADS1672_IOCTL_CLEAR_CONDITION:
-			ads1672_buf_clear_cond();
+
+		case ADS1672_IOCTL_SET_AVAIL_MIN:
+		{
+			unsigned int avail_min;
+			if (get_user(avail_min, (unsigned int __user *)arg))
+				return -EFAULT;
+			return ads1672_buf_set_avail_min(reader, avail_min);
+		}
+		case ADS1672_IOCTL_GET_AVAIL_MIN:
+			return put_user(reader->avail_min,
+					(unsigned int __user *)arg);
+
+		case ADS1672_IOCTL_SET_LIVE:
+		{
+			int live;
+			if (get_user(live, (int __user *)arg))
+				return -EFAULT;
+			ads1672_buf_set_live(reader, live != 0);
 			return 0;
+		}
+		case ADS1672_IOCTL_GET_LIVE:
+			return put_user(reader->live, (int __user *)arg);
 
-		case ADS1672_IOCTL_GET_TIMESPEC:
+		case ADS1672_IOCTL_QUEUE_BUFFER:
 		{
-			struct timespec * ts = (struct timespec *)arg;
-			if (!access_ok(VERIFY_WRITE, ts, sizeof(*ts)))
-				return -EINVAL;
-			ads1672_buf_get_timespec(ts);
+			int r;
+			struct ads1672_user_buffer b;
+			if (copy_from_user(&b, (void __user *)arg, sizeof(b)))
+				return -EFAULT;
+			r = ads1672_ubuf_queue(adc, f, &b);
+			if (r < 0)
+				return r;
+			if (copy_to_user((void __user *)arg, &b, sizeof(b)))
+				return -EFAULT;
 			return 0;
 		}
-		case ADS1672_IOCTL_GET_CONDITION:
+		case ADS1672_IOCTL_DEQUEUE_BUFFER:
 		{
-			int * cond = (int *)arg;
-			if (!access_ok(VERIFY_WRITE, cond, sizeof(*cond)))
-				return -EINVAL;
-			*cond = ads1672_buf_get_cond();
+			int r;
+			struct ads1672_user_buffer b;
+			r = ads1672_ubuf_dequeue(adc, f, &b,
+					f->f_flags & O_NONBLOCK);
+			if (r < 0)
+				return r;
+			if (copy_to_user((void __user *)arg, &b, sizeof(b)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADS1672_IOCTL_SET_GANG:
+		{
+			unsigned int mask;
+			if (get_user(mask, (unsigned int __user *)arg))
+				return -EFAULT;
+			return ads1672_gang_set(adc, reader, mask);
+		}
+		case ADS1672_IOCTL_TRIGGER:
+		{
+			int r;
+			struct ads1672_trigger t;
+			if (reader->gang)
+				return -EBUSY;
+			r = ads1672_trigger_start(adc, reader, &t);
+			if (r < 0)
+				return r;
+			if (copy_to_user((void __user *)arg, &t, sizeof(t)))
+				return -EFAULT;
 			return 0;
 		}
+		case ADS1672_IOCTL_TRIGGER_AT:
+		{
+			int r;
+			struct ads1672_trigger_at t;
+			if (reader->gang)
+				return -EBUSY;
+			if (copy_from_user(&t, (void __user *)arg, sizeof(t)))
+				return -EFAULT;
+			r = ads1672_trigger_start_at(adc, reader, &t);
+			if (r < 0)
+				return r;
+			if (copy_to_user((void __user *)arg, &t, sizeof(t)))
+				return -EFAULT;
+			return 0;
+		}
+		case ADS1672_IOCTL_RELEASE_BUFFERS:
+			if (ads1672_ubuf_is_owner(adc, f) &&
+					(ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING))
+				return -EBUSY;
+			return ads1672_ubuf_release(adc, f);
 
 		default:
 			return -ENOTTY;
 	}
 }
 
+static unsigned int ads1672_poll(struct file *f, poll_table *wait)
+{
+	struct ads1672_reader *reader = f->private_data;
+
+	if (reader->gang)
+		return ads1672_gang_poll(reader, f, wait) |
+			ads1672_ubuf_poll(file_adc(f), f, wait);
+
+	return ads1672_buf_poll(reader, f, wait) |
+		ads1672_ubuf_poll(file_adc(f), f, wait);
+}
+
+static int ads1672_mmap(struct file *f, struct vm_area_struct *vma)
+{
+	return ads1672_buf_mmap(file_adc(f), vma);
+}
+
 static int ads1672_open(struct inode *inode, struct file *f)
 {
-	if (inode->i_rdev != ads1672_get_dev())
-		return -ENODEV;
+	struct ads1672_device *adc = container_of(inode->i_cdev,
+			struct ads1672_device, cdev);
+	struct ads1672_reader *reader;
+	int r;
+
+	/* Each open file has its own read cursor. */
+	reader = kmalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
 
+	/* Set up the buffer and hardware on first use. */
+	r = ads1672_get(adc);
+	if (r < 0) {
+		kfree(reader);
+		return r;
+	}
+
+	mutex_lock(&adc->geometry_lock);
+	ads1672_buf_reader_init(adc, reader);
+	atomic_inc(&adc->open_count);
+	mutex_unlock(&adc->geometry_lock);
+
+	f->private_data = reader;
+
+	/* Reads honour IOCB_NOWAIT. */
+	f->f_mode |= FMODE_NOWAIT;
 	return 0;
 }
 
 static int ads1672_release(struct inode *inode, struct file *f)
 {
-	/* Nothing to do. */
+	struct ads1672_device *adc = container_of(inode->i_cdev,
+			struct ads1672_device, cdev);
+	struct ads1672_reader *reader = f->private_data;
+
+	/* A gang started through this file does not outlive it. */
+	ads1672_gang_clear(reader);
+
+	/* The DMA must not be left writing into pages we are about to unpin. */
+	if (ads1672_ubuf_is_owner(adc, f)) {
+		if (ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING)
+			ads1672_stop(adc);
+		ads1672_ubuf_release(adc, f);
+	}
+
+	ads1672_buf_reader_exit(reader);
+	kfree(reader);
+	atomic_dec(&adc->open_count);
+
+	ads1672_put(adc);
 	return 0;
 }
 
 static ssize_t ads1672_status_show(struct device *dev, struct device_attribute *unused, char *buf)
 {
-	int status = ads1672_mcbsp_status();
+	int status = ads1672_mcbsp_status(dev_adc(dev));
 
 	return scnprintf(buf, PAGE_SIZE, "%d\n", status);
 }
@@ -198,16 +544,16 @@ static ssize_t ads1672_status_store(struct device *dev, struct device_attribute
 		return r;
 
 	if (status & ADS1672_STATUS_RUNNING)
-		ads1672_mcbsp_start();
+		r = ads1672_start(dev_adc(dev), NULL);
 	else
-		ads1672_mcbsp_stop();
+		ads1672_stop(dev_adc(dev));
 
-	return count;
+	return r < 0 ? r : count;
 }
 
 static ssize_t ads1672_gpio_start_show(struct device *dev, struct device_attribute *unused, char *buf)
 {
-	int status = ads1672_gpio_start_get();
+	int status = ads1672_gpio_start_get(dev_adc(dev));
 
 	return scnprintf(buf, PAGE_SIZE, "%d\n", status);
 }
@@ -219,14 +565,14 @@ static ssize_t ads1672_gpio_start_store(struct device *dev, struct device_attrib
 	if (r < 0)
 		return r;
 
-	ads1672_gpio_start_set(status);
+	ads1672_gpio_start_set(dev_adc(dev), status);
 
 	return count;
 }
 
 static ssize_t ads1672_gpio_select_show(struct device *dev, struct device_attribute *unused, char *buf)
 {
-	int status = ads1672_gpio_select_get();
+	int status = ads1672_gpio_select_get(dev_adc(dev));
 
 	return scnprintf(buf, PAGE_SIZE, "%d\n", status);
 }
@@ -238,15 +584,27 @@ static ssize_t ads1672_gpio_select_store(struct device *dev, struct device_attri
 	if (r < 0)
 		return r;
 
-	ads1672_gpio_select_set(status);
+	ads1672_gpio_select_set(dev_adc(dev), status);
 
 	return count;
 }
 
+static ssize_t ads1672_period_length_show(struct device *dev, struct device_attribute *unused, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%u\n", dev_adc(dev)->period_length);
+}
+
+static ssize_t ads1672_nr_periods_show(struct device *dev, struct device_attribute *unused, char *buf)
+{
+	return scnprintf(buf, PAGE_SIZE, "%u\n", dev_adc(dev)->nr_periods);
+}
+
 /* Declare sysfs attributes for ADS1672 device. */
 static DEVICE_ATTR(status, 0660, ads1672_status_show, ads1672_status_store);
 static DEVICE_ATTR(gpio_start, 0660, ads1672_gpio_start_show, ads1672_gpio_start_store);
 static DEVICE_ATTR(gpio_select, 0660, ads1672_gpio_select_show, ads1672_gpio_select_store);
+static DEVICE_ATTR(period_length, 0444, ads1672_period_length_show, NULL);
+static DEVICE_ATTR(nr_periods, 0444, ads1672_nr_periods_show, NULL);
 
 /* Called on release of ADS1672 device - necessary to unload the module without
  * error
@@ -260,48 +618,126 @@ static void ads1672_device_release(struct device *dev)
 	Public functions.
 *******************************************************************************/
 
-dev_t ads1672_get_dev(void)
+
+int ads1672_start(struct ads1672_device *adc, struct file *f)
 {
-	return MKDEV(major, minor);
+	int r;
+
+	mutex_lock(&adc->start_lock);
+
+	if (!adc->running_ref) {
+		r = ads1672_get(adc);
+		if (r < 0)
+			goto out;
+		adc->running_ref = true;
+	}
+
+	r = ads1672_start_locked(adc, f);
+
+	if (!(ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING)) {
+		adc->running_ref = false;
+		ads1672_put(adc);
+	}
+
+out:
+	mutex_unlock(&adc->start_lock);
+	return r;
 }
 
-int ads1672_device_init(void)
+void ads1672_stop(struct ads1672_device *adc)
+{
+	mutex_lock(&adc->start_lock);
+
+	/* A scheduled start must not raise START once we have stopped. */
+	ads1672_trigger_cancel(adc);
+
+	if (adc->running_ref) {
+		ads1672_mcbsp_stop(adc);
+		ads1672_ubuf_stop(adc);
+		adc->running_ref = false;
+		ads1672_put(adc);
+	}
+
+	mutex_unlock(&adc->start_lock);
+}
+
+dev_t ads1672_get_dev(struct ads1672_device *adc)
+{
+	return MKDEV(major, minor + adc->index);
+}
+
+int ads1672_device_register(uint nr_devices)
 {
 	int r;
 	dev_t dev;
 
 	if (major) {
-		dev = ads1672_get_dev();
-		r = register_chrdev_region(dev, 1, "ads1672");
+		dev = MKDEV(major, minor);
+		r = register_chrdev_region(dev, nr_devices, "ads1672");
 		
 		if (r < 0) {
 			printk(KERN_WARNING "ads1672: "
-					"Cannot register char device %d,%d\n",
+					"Cannot register char devices %d,%d\n",
 					major, minor);
 			return r;
 		}
 	} else {
-		r = alloc_chrdev_region(&dev, minor, 1, "ads1672");
-		major = MAJOR(dev);
+		r = alloc_chrdev_region(&dev, minor, nr_devices, "ads1672");
 
 		if (r < 0) {
 			printk(KERN_WARNING "ads1672: "
-					"Cannot allocate char device "
+					"Cannot allocate char devices "
 					"minor=%d\n", minor);
 			return r;
 		}
+		major = MAJOR(dev);
 	}
 
+#if LINUX_VERSION_CODE >= KERNEL_VERSION(6, 4, 0)
+	ads1672_class = class_create("ads1672");
+#else
+	ads1672_class = class_create(THIS_MODULE, "ads1672");
+#endif
+	if (IS_ERR(ads1672_class)) {
+		r = PTR_ERR(ads1672_class);
+		printk(KERN_WARNING "ads1672: "
+				"Error %d creating device class\n", r);
+		ads1672_class = NULL;
+		unregister_chrdev_region(dev, nr_devices);
+		return r;
+	}
+
+	return 0;
+}
+
+void ads1672_device_unregister(uint nr_devices)
+{
+	class_destroy(ads1672_class);
+	ads1672_class = NULL;
+	unregister_chrdev_region(MKDEV(major, minor), nr_devices);
+}
+
+int ads1672_device_init(struct ads1672_device *adc)
+{
+	dev_t dev = ads1672_get_dev(adc);
+	int r;
+
+	atomic_set(&adc->open_count, 0);
+	mutex_init(&adc->geometry_lock);
+	mutex_init(&adc->start_lock);
+	adc->running_ref = false;
+	adc->scheduled = NULL;
+
 	/* Blank structures so we know they don't contain garbage.*/
-	memset(&cdev, 0, sizeof(cdev));
-	memset(&plat, 0, sizeof(plat));
+	memset(&adc->cdev, 0, sizeof(adc->cdev));
+	memset(&adc->plat, 0, sizeof(adc->plat));
 
 	/* Setup character device. */
-	cdev_init(&cdev, &fops);
-	cdev.owner = THIS_MODULE;
-	cdev.ops = &fops;
+	cdev_init(&adc->cdev, &fops);
+	adc->cdev.owner = THIS_MODULE;
+	adc->cdev.ops = &fops;
 	
-	r = cdev_add(&cdev, dev, 1);
+	r = cdev_add(&adc->cdev, dev, 1);
 	if (r < 0) {
 		printk(KERN_WARNING "ads1672: "
 				"Error %d when adding char device\n", r);
@@ -309,54 +745,100 @@ int ads1672_device_init(void)
 	}
 
 	/* Initialize platform device object so we appear in sysfs. */
-	plat.name = "ads1672";
-	plat.id = -1;
-	plat.num_resources = 0;
-	plat.dev.release = ads1672_device_release;
+	adc->plat.name = "ads1672";
+	adc->plat.id = adc->index;
+	adc->plat.num_resources = 0;
+	adc->plat.dev.release = ads1672_device_release;
 
-	r = platform_device_register(&plat);
+	r = platform_device_register(&adc->plat);
 	if (r < 0) {
 		printk(KERN_WARNING "ads1672: "
 				"Error %d initializing platform device\n", r);
-		cdev_del(&cdev);
+		cdev_del(&adc->cdev);
 		return r;
 	}
 
-	r = device_create_file(&plat.dev, &dev_attr_status);
+	/* The sample buffers are mapped for DMA on behalf of the platform
+	 * device, see buffer.c and ubuf.c.
+	 */
+	r = dma_coerce_mask_and_coherent(&adc->plat.dev, DMA_BIT_MASK(32));
+	if (r < 0) {
+		printk(KERN_WARNING "ads1672: "
+				"Error %d setting DMA mask\n", r);
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
+		return r;
+	}
+
+	r = device_create_file(&adc->plat.dev, &dev_attr_status);
 	if (r < 0) {
 		printk(KERN_WARNING "ads1672: "
 				"Error %d creating 'status' device attribute\n",
 				r);
-		platform_device_unregister(&plat);
-		cdev_del(&cdev);
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
 		return r;
 	}
 
-	r = device_create_file(&plat.dev, &dev_attr_gpio_start);
+	r = device_create_file(&adc->plat.dev, &dev_attr_gpio_start);
 	if (r < 0) {
 		printk(KERN_WARNING "ads1672: "
 				"Error %d creating 'gpio_start' device attribute\n",
 				r);
-		platform_device_unregister(&plat);
-		cdev_del(&cdev);
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
 		return r;
 	}
 
-	r = device_create_file(&plat.dev, &dev_attr_gpio_select);
+	r = device_create_file(&adc->plat.dev, &dev_attr_gpio_select);
 	if (r < 0) {
 		printk(KERN_WARNING "ads1672: "
 				"Error %d creating 'gpio_select' device attribute\n",
 				r);
-		platform_device_unregister(&plat);
-		cdev_del(&cdev);
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
+		return r;
+	}
+
+	r = device_create_file(&adc->plat.dev, &dev_attr_period_length);
+	if (r < 0) {
+		printk(KERN_WARNING "ads1672: "
+				"Error %d creating 'period_length' device attribute\n",
+				r);
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
+		return r;
+	}
+
+	r = device_create_file(&adc->plat.dev, &dev_attr_nr_periods);
+	if (r < 0) {
+		printk(KERN_WARNING "ads1672: "
+				"Error %d creating 'nr_periods' device attribute\n",
+				r);
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
+		return r;
+	}
+
+	/* Create the device node, /dev/ads1672.N. */
+	adc->node = device_create(ads1672_class, &adc->plat.dev, dev, adc,
+			"ads1672.%u", adc->index);
+	if (IS_ERR(adc->node)) {
+		r = PTR_ERR(adc->node);
+		printk(KERN_WARNING "ads1672: "
+				"Error %d creating device node\n", r);
+		adc->node = NULL;
+		platform_device_unregister(&adc->plat);
+		cdev_del(&adc->cdev);
 		return r;
 	}
 
 	return 0;
 }
 
-void ads1672_device_exit(void)
+void ads1672_device_exit(struct ads1672_device *adc)
 {
-	platform_device_unregister(&plat);
-	cdev_del(&cdev);
+	device_destroy(ads1672_class, ads1672_get_dev(adc));
+	platform_device_unregister(&adc->plat);
+	cdev_del(&adc->cdev);
 }
@@ -24,19 +24,114 @@
 #ifndef __ADS1672_DEVICE_H_INCLUDED__
 #define __ADS1672_DEVICE_H_INCLUDED__
 
+#include <linux/atomic.h>
+#include <linux/cdev.h>
+#include <linux/mutex.h>
+#include <linux/platform_device.h>
+#include <linux/types.h>
+#include <linux/workqueue.h>
+
+/**
+ * Largest number of ADS1672 devices the module can drive, one for each McBSP
+ * port on the OMAP35xx.
+ */
+#define ADS1672_MAX_DEVICES	5
+
+struct file;
+struct ads1672_buf;
+struct ads1672_mcbsp;
+struct ads1672_scheduled_start;
+struct ads1672_ubuf;
+
+/**
+ * State of a single ADS1672 device. Each device has its own serial port, DMA
+ * channel, buffer and device node, /dev/ads1672.N where N is its index.
+ */
+struct ads1672_device {
+	/* Index of the device, its minor number relative to the first. */
+	uint				index;
+
+	/* Geometry of the buffer. This is kept while the buffer is torn down
+	 * so that the next session uses the geometry of the last.
+	 */
+	uint				period_length;
+	uint				nr_periods;
+
+	/* Private state of the buffer, the hardware interface and the user
+	 * buffers. The first two are only set while the device is in use, see
+	 * module.c.
+	 */
+	struct ads1672_buf *		buf;
+	struct ads1672_mcbsp *		mcbsp;
+	struct ads1672_ubuf *		ubuf;
+
+	/* Character and platform device objects. */
+	struct cdev			cdev;
+	struct platform_device		plat;
+	struct device *			node;
+
+	/* Number of open file handles. */
+	atomic_t			open_count;
+
+	/* Serialises changes to the buffer geometry. */
+	struct mutex			geometry_lock;
+
+	/* A running capture holds a reference on the buffer and hardware, so
+	 * that it may be started through sysfs without any open file.
+	 * Serialised by start_lock.
+	 */
+	struct mutex			start_lock;
+	bool				running_ref;
+
+	/* Start armed by ads1672_trigger_start_at() and waiting for its timer,
+	 * or NULL. Serialised by start_lock.
+	 */
+	struct ads1672_scheduled_start *	scheduled;
+
+	/* Users of the buffer and hardware, see module.c. */
+	struct mutex			active_lock;
+	uint				active_count;
+	bool				active;
+	struct delayed_work		idle_work;
+};
+
+/**
+ * Start capture on a device, as the START ioctl does.
+ *	\param [in] f	The file asking, or NULL if there is none.
+ *
+ * \returns 0 on success or <0 on error.
+ */
+int ads1672_start(struct ads1672_device * adc, struct file * f);
+
+/**
+ * Stop capture on a device.
+ */
+void ads1672_stop(struct ads1672_device * adc);
+
+/**
+ * Get the device number of an ADS1672 device.
+ */
+dev_t ads1672_get_dev(struct ads1672_device * adc);
+
+/**
+ * Allocate device numbers for nr_devices ADS1672 devices and create their
+ * device class.
+ */
+int ads1672_device_register(uint nr_devices);
+
 /**
- * Get first device number used by ADS1672 module.
+ * Release the device numbers and class allocated by ads1672_device_register().
  */
-dev_t ads1672_get_dev(void);
+void ads1672_device_unregister(uint nr_devices);
 
 /**
- * Initialise the ads1672 character and platform device objects.
+ * Initialise the character and platform device objects of an ADS1672 device.
  */
-int ads1672_device_init(void);
+int ads1672_device_init(struct ads1672_device * adc);
 
 /**
- * Destroy the ads1672 character and platform device objects.
+ * Destroy the character and platform device objects of an ADS1672 device.
  */
-void ads1672_device_exit(void);
+void ads1672_device_exit(struct ads1672_device * adc);
 
 #endif /* !__ADS1672_DEVICE_H_INCLUDED__ */
@@ -0,0 +1,137 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * format.c
+ * Output sample formats for ads1672 driver.
+ */
+
+#include <ads1672.h>
+#include <linux/kernel.h>
+#include <linux/string.h>
+#include <linux/types.h>
+#include <asm/byteorder.h>
+#include <asm/unaligned.h>
+
+#include "format.h"
+
+/*******************************************************************************
+	Private functions
+*******************************************************************************/
+
+/* Pack 24 bit samples into 3 bytes each, little-endian.
+ *
+ * Four samples fit exactly into three 32 bit words, so the bulk of the work is
+ * done a group of four at a time with word loads and stores rather than a byte
+ * at a time. The destination need not be aligned, on ARMv6 and later
+ * put_unaligned() is a plain word store.
+ */
+static void pack_s24(u8 * out, const ads1672_sample_t * in, uint count)
+{
+	u32 s0, s1, s2, s3;
+	__le32 * w;
+
+	while (count >= 4) {
+		s0 = in[0];
+		s1 = in[1];
+		s2 = in[2];
+		s3 = in[3];
+
+		w = (__le32 *) out;
+		put_unaligned(cpu_to_le32((s0 & 0xFFFFFF) | (s1 << 24)), &w[0]);
+		put_unaligned(cpu_to_le32(((s1 >> 8) & 0xFFFF) | (s2 << 16)),
+				&w[1]);
+		put_unaligned(cpu_to_le32(((s2 >> 16) & 0xFF) | (s3 << 8)),
+				&w[2]);
+
+		in += 4;
+		out += 12;
+		count -= 4;
+	}
+
+	while (count--) {
+		s0 = *in++;
+		*out++ = s0;
+		*out++ = s0 >> 8;
+		*out++ = s0 >> 16;
+	}
+}
+
+/* Truncate 24 bit samples to their 16 most significant bits, little-endian,
+ * two samples to each 32 bit word.
+ */
+static void pack_s16(u8 * out, const ads1672_sample_t * in, uint count)
+{
+	u32 s0, s1;
+
+	while (count >= 2) {
+		s0 = in[0];
+		s1 = in[1];
+
+		put_unaligned(cpu_to_le32(((s0 >> 8) & 0xFFFF) |
+					((s1 >> 8) << 16)), (__le32 *) out);
+
+		in += 2;
+		out += 4;
+		count -= 2;
+	}
+
+	if (count) {
+		s0 = *in;
+		put_unaligned(cpu_to_le16(s0 >> 8), (__le16 *) out);
+	}
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+size_t ads1672_format_sample_size(int format)
+{
+	switch (format) {
+		case ADS1672_FORMAT_S32:
+			return sizeof(ads1672_sample_t);
+
+		case ADS1672_FORMAT_S24_PACKED:
+			return 3;
+
+		case ADS1672_FORMAT_S16:
+			return 2;
+
+		default:
+			return 0;
+	}
+}
+
+void ads1672_format_pack(int format, void * out, const ads1672_sample_t * in,
+		uint count)
+{
+	switch (format) {
+		case ADS1672_FORMAT_S24_PACKED:
+			pack_s24(out, in, count);
+			break;
+
+		case ADS1672_FORMAT_S16:
+			pack_s16(out, in, count);
+			break;
+
+		default:
+			memcpy(out, in, count * sizeof(ads1672_sample_t));
+			break;
+	}
+}
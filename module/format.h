@@ -0,0 +1,46 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/**
+ * \file format.h
+ * Output sample formats for ads1672 driver.
+ */
+
+#ifndef __ADS1672_FORMAT_H_INCLUDED__
+#define __ADS1672_FORMAT_H_INCLUDED__
+
+#include <ads1672.h>
+
+/**
+ * Get the size in bytes of one sample in the given format.
+ *
+ * \returns the sample size or 0 if the format is not recognised.
+ */
+size_t ads1672_format_sample_size(int format);
+
+/**
+ * Convert samples from the DMA buffer into the given format.
+ *	\param [in] format	One of ::ADS1672_FORMAT.
+ *	\param [out] out	Destination, count samples in the given format.
+ *	\param [in] in		Source, count samples as stored in the buffer.
+ *	\param [in] count	Number of samples to convert.
+ */
+void ads1672_format_pack(int format, void * out, const ads1672_sample_t * in,
+		uint count);
+
+#endif /* !__ADS1672_FORMAT_H_INCLUDED__ */
@@ -0,0 +1,603 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * gang.c
+ * Ganged capture across several ADS1672 devices.
+ */
+
+#include <ads1672.h>
+#include <linux/atomic.h>
+#include <linux/irqflags.h>
+#include <linux/kernel.h>
+#include <linux/mutex.h>
+#include <linux/poll.h>
+#include <linux/slab.h>
+#include <linux/time.h>
+#include <linux/uio.h>
+#include <linux/wait.h>
+
+#include "buffer.h"
+#include "device.h"
+#include "format.h"
+#include "gang.h"
+#include "gpio.h"
+#include "mcbsp.h"
+#include "module.h"
+#include "ubuf.h"
+
+/*******************************************************************************
+	Private declarations and data.
+*******************************************************************************/
+
+/*
+ * A gang belongs to an open file and reads its devices through readers of its
+ * own, leaving the file's reader idle. Everything here is serialised by the
+ * lock of the file's reader, which also guards its gang pointer. A read drops
+ * that lock while it sleeps, counting itself as a waiter on the file's reader
+ * so that the gang and the format are left alone until it wakes.
+ *
+ * The devices are started together with their START pins held low and then
+ * raised in one go, so sample N of one device was taken at the same time as
+ * sample N of the others. Each device's ring keeps its own sequence numbers,
+ * so period base[i] + k of device i lines up with period base[j] + k of
+ * device j.
+ */
+struct ads1672_gang {
+	/* Number of devices, and the devices and their readers in order of
+	 * index.
+	 */
+	uint				nr;
+	struct ads1672_device *		adc[ADS1672_MAX_DEVICES];
+	struct ads1672_reader *		reader[ADS1672_MAX_DEVICES];
+
+	/* Sequence number of each device's first period since the gang was
+	 * started.
+	 */
+	uint				base[ADS1672_MAX_DEVICES];
+
+	/* Started through ads1672_gang_start() and not yet stopped. */
+	bool				running;
+
+	/* Set when the devices are found to be out of step, until the
+	 * condition is cleared.
+	 */
+	bool				misaligned;
+
+	/* Number of samples taken from each device per pass, and bounce
+	 * buffers for those samples and for the interleaved frames.
+	 */
+	uint				chunk;
+	ads1672_sample_t *		in;
+	ads1672_sample_t *		frames;
+};
+
+/* Frames whose timestamps differ by more than this fraction of a period are
+ * taken to be out of step.
+ */
+#define TS_TOLERANCE_SHIFT	1
+
+/*******************************************************************************
+	Private functions.
+*******************************************************************************/
+
+static void free_gang(struct ads1672_gang * g)
+{
+	struct ads1672_device * adc;
+	uint i;
+
+	if (!g)
+		return;
+
+	for (i = 0; i < g->nr; i++) {
+		adc = g->adc[i];
+
+		ads1672_buf_reader_exit(g->reader[i]);
+		kfree(g->reader[i]);
+		atomic_dec(&adc->open_count);
+		ads1672_put(adc);
+	}
+
+	kfree(g->in);
+	kfree(g->frames);
+	kfree(g);
+}
+
+/* Add a device to a gang with a reader of its own. The device's open count is
+ * raised as for an open file, so its geometry cannot change under the gang.
+ */
+static int add_member(struct ads1672_gang * g, struct ads1672_device * adc,
+		uint period_length)
+{
+	struct ads1672_reader * reader;
+	int r;
+
+	reader = kmalloc(sizeof(*reader), GFP_KERNEL);
+	if (!reader)
+		return -ENOMEM;
+
+	r = ads1672_get(adc);
+	if (r < 0) {
+		kfree(reader);
+		return r;
+	}
+
+	mutex_lock(&adc->geometry_lock);
+	ads1672_buf_reader_init(adc, reader);
+	atomic_inc(&adc->open_count);
+	mutex_unlock(&adc->geometry_lock);
+
+	g->adc[g->nr] = adc;
+	g->reader[g->nr] = reader;
+	g->nr++;
+
+	/* Frames are only meaningful if every device has periods of the same
+	 * length.
+	 */
+	if (adc->period_length != period_length)
+		return -EINVAL;
+
+	return 0;
+}
+
+static struct ads1672_gang * alloc_gang(struct ads1672_device * adc, uint mask)
+{
+	struct ads1672_gang * g;
+	struct ads1672_device * member;
+	uint i;
+	int r;
+
+	if (!(mask & (1 << adc->index)) || mask >> ADS1672_MAX_DEVICES)
+		return ERR_PTR(-EINVAL);
+
+	g = kzalloc(sizeof(*g), GFP_KERNEL);
+	if (!g)
+		return ERR_PTR(-ENOMEM);
+
+	for (i = 0; i < ADS1672_MAX_DEVICES; i++) {
+		if (!(mask & (1 << i)))
+			continue;
+
+		member = ads1672_get_device(i);
+		if (!member) {
+			r = -EINVAL;
+			goto err;
+		}
+
+		r = add_member(g, member, adc->period_length);
+		if (r < 0)
+			goto err;
+
+		if (ads1672_mcbsp_status(member) & ADS1672_STATUS_RUNNING) {
+			r = -EBUSY;
+			goto err;
+		}
+	}
+
+	g->chunk = ADS1672_BOUNCE_SAMPLES / g->nr;
+	g->in = kmalloc(ADS1672_BOUNCE_SIZE, GFP_KERNEL);
+	g->frames = kmalloc(ADS1672_BOUNCE_SIZE, GFP_KERNEL);
+	if (!g->in || !g->frames) {
+		r = -ENOMEM;
+		goto err;
+	}
+
+	return g;
+
+err:
+	free_gang(g);
+	return ERR_PTR(r);
+}
+
+/* Stop every device, holding the converters in reset first. */
+static void stop_members(struct ads1672_gang * g)
+{
+	uint i;
+
+	for (i = 0; i < g->nr; i++)
+		ads1672_gpio_start_set(g->adc[i], 0);
+	for (i = 0; i < g->nr; i++)
+		ads1672_stop(g->adc[i]);
+	g->running = false;
+}
+
+/* Wait for every device to have samples in the period the gang is reading and
+ * check that they are in step. Returns the number of samples left in the
+ * period, which may be zero, or a negative error code.
+ */
+static int wait_members(struct ads1672_gang * g, bool nonblock)
+{
+	struct ads1672_position pos;
+	struct __kernel_timespec ts;
+	uint seq = 0, offset = 0, nr_samples = 0;
+	s64 ns = 0, tolerance;
+	uint i;
+	int r;
+
+	tolerance = ads1672_buf_samples_to_ns(g->adc[0]->period_length) >>
+		TS_TOLERANCE_SHIFT;
+
+	for (i = 0; i < g->nr; i++) {
+		r = ads1672_buf_wait(g->reader[i], &pos, nonblock);
+		if (r < 0)
+			return r;
+		if (pos.cond != ADS1672_COND_OK)
+			return -EIO;
+
+		ads1672_buf_get_timespec(g->reader[i], &ts);
+
+		/* Nothing else uses the gang's readers, so the copy of the
+		 * period's status is stable while we hold the file's lock.
+		 */
+		if (i == 0) {
+			seq = pos.seq - g->base[0];
+			offset = pos.offset;
+			nr_samples = g->reader[0]->nr_samples;
+			ns = ads1672_buf_ts_to_ns(&ts);
+			continue;
+		}
+
+		if (pos.seq - g->base[i] != seq || pos.offset != offset ||
+				g->reader[i]->nr_samples != nr_samples ||
+				abs(ads1672_buf_ts_to_ns(&ts) - ns) > tolerance) {
+			g->misaligned = true;
+			return -EIO;
+		}
+	}
+
+	return nr_samples > offset ? nr_samples - offset : 0;
+}
+
+/* Release the lock of the file's reader. A poll which found it taken waits on
+ * the reader's queue, so wake it to look again.
+ */
+static void unlock_reader(struct ads1672_reader * reader)
+{
+	mutex_unlock(&reader->lock);
+	wake_up_interruptible(&reader->wait);
+}
+
+/* Sleep until every device has met its watermark. The lock of the file's
+ * reader is dropped meanwhile, so that stop, poll and the condition calls are
+ * not held up, and the caller must check the devices again afterwards. Called
+ * with that lock held.
+ */
+static int sleep_members(struct ads1672_reader * reader,
+		struct ads1672_gang * g)
+{
+	uint i;
+	int r = 0;
+
+	reader->waiters++;
+	unlock_reader(reader);
+
+	for (i = 0; i < g->nr && r == 0; i++)
+		r = ads1672_buf_sleep(g->reader[i]);
+
+	mutex_lock(&reader->lock);
+	reader->waiters--;
+	return r;
+}
+
+/* Interleave n samples from each device into frames. */
+static void interleave(struct ads1672_gang * g, uint n)
+{
+	ads1672_sample_t * out = g->frames;
+	uint i, j;
+
+	for (j = 0; j < n; j++)
+		for (i = 0; i < g->nr; i++)
+			*out++ = g->in[i * g->chunk + j];
+}
+
+/*******************************************************************************
+	Public functions.
+*******************************************************************************/
+
+int ads1672_gang_set(struct ads1672_device * adc,
+		struct ads1672_reader * reader, uint mask)
+{
+	struct ads1672_gang * g = NULL, * old;
+
+	if (mask) {
+		g = alloc_gang(adc, mask);
+		if (IS_ERR(g))
+			return PTR_ERR(g);
+	}
+
+	mutex_lock(&reader->lock);
+
+	/* A read asleep on the old gang must find it there when it wakes. */
+	old = reader->gang;
+	if (old && (old->running || reader->waiters)) {
+		unlock_reader(reader);
+		free_gang(g);
+		return -EBUSY;
+	}
+	reader->gang = g;
+
+	unlock_reader(reader);
+
+	free_gang(old);
+	return 0;
+}
+
+void ads1672_gang_clear(struct ads1672_reader * reader)
+{
+	struct ads1672_gang * g;
+
+	mutex_lock(&reader->lock);
+
+	g = reader->gang;
+	if (g && g->running)
+		stop_members(g);
+	reader->gang = NULL;
+
+	unlock_reader(reader);
+
+	free_gang(g);
+}
+
+int ads1672_gang_start(struct ads1672_reader * reader)
+{
+	struct ads1672_gang * g;
+	unsigned long flags;
+	uint i;
+	int r = 0;
+
+	mutex_lock(&reader->lock);
+
+	g = reader->gang;
+	if (!g) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	/* Every device must start from rest, into its own ring. */
+	for (i = 0; i < g->nr; i++) {
+		if ((ads1672_mcbsp_status(g->adc[i]) & ADS1672_STATUS_RUNNING) ||
+				ads1672_ubuf_active(g->adc[i])) {
+			r = -EBUSY;
+			goto out;
+		}
+	}
+
+	/* Hold every converter in reset while the transfers are armed, so
+	 * that none of them produces a sample before the others.
+	 */
+	for (i = 0; i < g->nr; i++)
+		ads1672_gpio_start_set(g->adc[i], 0);
+
+	for (i = 0; i < g->nr; i++) {
+		r = ads1672_start(g->adc[i], NULL);
+		if (r == 0 && !(ads1672_mcbsp_status(g->adc[i]) &
+					ADS1672_STATUS_RUNNING))
+			r = -EIO;
+		if (r < 0)
+			goto unwind;
+
+		g->base[i] = ads1672_buf_get_write_seq(g->adc[i]);
+		ads1672_buf_seek(g->reader[i], g->base[i]);
+	}
+
+	g->running = true;
+	g->misaligned = false;
+
+	/* Release them together. Shared START pins are simply set again. */
+	local_irq_save(flags);
+	for (i = 0; i < g->nr; i++)
+		ads1672_gpio_start_set(g->adc[i], 1);
+	local_irq_restore(flags);
+
+	goto out;
+
+unwind:
+	while (i--)
+		ads1672_stop(g->adc[i]);
+out:
+	unlock_reader(reader);
+	return r;
+}
+
+void ads1672_gang_stop(struct ads1672_reader * reader)
+{
+	struct ads1672_gang * g;
+
+	mutex_lock(&reader->lock);
+
+	g = reader->gang;
+	if (g)
+		stop_members(g);
+
+	unlock_reader(reader);
+}
+
+ssize_t ads1672_gang_read_iter(struct ads1672_reader * reader,
+		struct iov_iter * to, bool nonblock)
+{
+	struct ads1672_gang * g;
+	size_t frame_size;
+	uint count, done = 0, n, i;
+	int r;
+
+	/* A non-blocking caller must not sleep on another user of this file
+	 * either.
+	 */
+	if (nonblock) {
+		if (!mutex_trylock(&reader->lock))
+			return -EAGAIN;
+	} else {
+		mutex_lock(&reader->lock);
+	}
+
+	g = reader->gang;
+	if (!g) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	frame_size = g->nr * ads1672_format_sample_size(reader->format);
+	count = iov_iter_count(to) / frame_size;
+	if (count < 1) {
+		r = -EINVAL;
+		goto out;
+	}
+
+	/* As for a single device, only the first period is waited for. */
+	while (done < count) {
+		r = wait_members(g, true);
+		if (r == -EAGAIN && !nonblock && !done) {
+			r = sleep_members(reader, g);
+			if (r < 0)
+				break;
+			continue;
+		}
+		if (r < 0)
+			break;
+
+		/* A period every device lost in the same way is skipped. */
+		if (r == 0) {
+			for (i = 0; i < g->nr; i++)
+				ads1672_buf_advance(g->reader[i]);
+			continue;
+		}
+
+		n = min3(count - done, g->chunk, (uint) r);
+		for (i = 0; i < g->nr; i++) {
+			r = ads1672_buf_readk(g->reader[i],
+					&g->in[i * g->chunk],
+					n * sizeof(ads1672_sample_t), true);
+			if (r != n * sizeof(ads1672_sample_t)) {
+				g->misaligned = true;
+				r = -EIO;
+				break;
+			}
+		}
+		if (r < 0)
+			break;
+
+		interleave(g, n);
+		ads1672_format_pack(reader->format, g->in, g->frames,
+				n * g->nr);
+		if (copy_to_iter(g->in, n * frame_size, to) != n * frame_size) {
+			r = -EFAULT;
+			break;
+		}
+
+		done += n;
+	}
+
+	if (done)
+		r = done * frame_size;
+
+out:
+	unlock_reader(reader);
+	return r;
+}
+
+unsigned int ads1672_gang_poll(struct ads1672_reader * reader, struct file * f,
+		poll_table * wait)
+{
+	struct ads1672_gang * g;
+	unsigned int mask = 0, in = POLLIN | POLLRDNORM, m;
+	uint i;
+
+	/* Poll must not sleep on the lock. If it is taken, wait for it to be
+	 * released and look again then.
+	 */
+	poll_wait(f, &reader->wait, wait);
+	if (!mutex_trylock(&reader->lock))
+		return 0;
+
+	/* Frames can only be read once every device has samples, but any
+	 * device with a condition to clear stops the read.
+	 */
+	g = reader->gang;
+	if (g) {
+		for (i = 0; i < g->nr; i++) {
+			m = ads1672_buf_poll(g->reader[i], f, wait);
+			in &= m;
+			mask |= m & POLLPRI;
+		}
+		mask |= in;
+		if (g->misaligned)
+			mask |= POLLPRI;
+	}
+
+	unlock_reader(reader);
+	return mask;
+}
+
+int ads1672_gang_get_cond(struct ads1672_reader * reader)
+{
+	struct ads1672_gang * g;
+	int cond = ADS1672_COND_OK;
+	uint i;
+
+	mutex_lock(&reader->lock);
+
+	g = reader->gang;
+	if (g && g->misaligned) {
+		cond = ADS1672_COND_MISALIGNED;
+	} else if (g) {
+		for (i = 0; i < g->nr && cond == ADS1672_COND_OK; i++)
+			cond = ads1672_buf_get_cond(g->reader[i]);
+	}
+
+	unlock_reader(reader);
+	return cond;
+}
+
+void ads1672_gang_clear_cond(struct ads1672_reader * reader)
+{
+	struct ads1672_gang * g;
+	uint i, seq, last = 0;
+
+	mutex_lock(&reader->lock);
+
+	g = reader->gang;
+	if (!g)
+		goto out;
+
+	/* Find the latest period any device has moved on to, counting from
+	 * the start of the gang. A device part way through a period is
+	 * counted as having moved past it. Getting the condition first
+	 * catches up any reader which has been overrun.
+	 */
+	for (i = 0; i < g->nr; i++) {
+		ads1672_buf_get_cond(g->reader[i]);
+		ads1672_buf_clear_cond(g->reader[i]);
+
+		seq = g->reader[i]->seq - g->base[i];
+		if (g->reader[i]->offset)
+			seq++;
+		if (seq > last)
+			last = seq;
+	}
+
+	/* Bring every device to the start of that period. If one of them has
+	 * not got there yet, leave the gang misaligned for another try.
+	 */
+	g->misaligned = false;
+	for (i = 0; i < g->nr; i++)
+		if (ads1672_buf_seek(g->reader[i], g->base[i] + last) < 0)
+			g->misaligned = true;
+
+out:
+	unlock_reader(reader);
+}
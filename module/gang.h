@@ -0,0 +1,97 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/**
+ * \file gang.h
+ * Ganged capture across several ADS1672 devices.
+ */
+
+#ifndef __ADS1672_GANG_H_INCLUDED__
+#define __ADS1672_GANG_H_INCLUDED__
+
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/types.h>
+#include <linux/uio.h>
+
+struct ads1672_device;
+struct ads1672_reader;
+
+/**
+ * Gang the device of an open file with other devices, or leave the gang.
+ *	\param [in] adc	The device of the file.
+ *	\param [in] reader	The reader of the file.
+ *	\param [in] mask	Bit N set for device N, including adc, or 0.
+ *
+ * \returns 0 on success, -EBUSY if any device involved is running or a read
+ * is asleep on the gang, or -EINVAL if the mask or the geometry of the devices
+ * is unsuitable.
+ */
+int ads1672_gang_set(struct ads1672_device * adc,
+		struct ads1672_reader * reader, uint mask);
+
+/**
+ * Leave any gang, as when the file is closed. A running gang is stopped first.
+ */
+void ads1672_gang_clear(struct ads1672_reader * reader);
+
+/**
+ * Start every device in the gang on the same edge of their START pins.
+ *
+ * \returns 0 on success or <0 on error, in which case no device is left
+ * running.
+ */
+int ads1672_gang_start(struct ads1672_reader * reader);
+
+/**
+ * Stop every device in the gang.
+ */
+void ads1672_gang_stop(struct ads1672_reader * reader);
+
+/**
+ * Read interleaved frames from the gang into an iterator.
+ *	\param [in] nonblock	Return -EAGAIN rather than waiting.
+ *
+ * \returns the number of bytes read or <0 on error. -EIO means a device has a
+ * condition other than ADS1672_COND_OK or is out of step with the others.
+ */
+ssize_t ads1672_gang_read_iter(struct ads1672_reader * reader,
+		struct iov_iter * to, bool nonblock);
+
+/**
+ * Poll the gang, for use as the poll file operation. It is readable once every
+ * device is. While another thread is using the gang the poll waits for it to
+ * finish.
+ */
+unsigned int ads1672_gang_poll(struct ads1672_reader * reader, struct file * f,
+		poll_table * wait);
+
+/**
+ * Get the condition of the gang: ADS1672_COND_MISALIGNED if the devices are
+ * out of step, else the first condition other than ADS1672_COND_OK of any
+ * device.
+ */
+int ads1672_gang_get_cond(struct ads1672_reader * reader);
+
+/**
+ * Clear the condition of every device and realign them at the first period
+ * which all of them have.
+ */
+void ads1672_gang_clear_cond(struct ads1672_reader * reader);
+
+#endif /* !__ADS1672_GANG_H_INCLUDED__ */
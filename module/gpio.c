@@ -23,51 +23,85 @@
 
 #include <ads1672.h>
 #include <linux/gpio.h>
-#include <plat/mux.h>
+#include <linux/moduleparam.h>
 
+#include "device.h"
 #include "gpio.h"
 
-/* GPIO pin numbers. */
-#define ADS1672_GPIO_START      138
-#define ADS1672_GPIO_SELECT     139
+/* GPIO pin numbers of the START and chip select lines of each device. */
+static int gpio_start[ADS1672_MAX_DEVICES] = { 138, -1, -1, -1, -1 };
+module_param_array(gpio_start, int, NULL, S_IRUGO);
 
-int ads1672_gpio_start_get(void)
+static int gpio_select[ADS1672_MAX_DEVICES] = { 139, -1, -1, -1, -1 };
+module_param_array(gpio_select, int, NULL, S_IRUGO);
+
+/* Devices may share a START line so that they can be started on the same edge,
+ * see gang.c. Such a pin belongs to the first device using it, which requests
+ * and frees it for all of them. Devices are set up in order of index and torn
+ * down in reverse, so the owner outlives the others.
+ */
+static bool start_shared(struct ads1672_device * adc)
+{
+        uint i;
+
+        for (i = 0; i < adc->index; i++)
+                if (gpio_start[i] == gpio_start[adc->index])
+                        return true;
+        return false;
+}
+
+int ads1672_gpio_start_get(struct ads1672_device * adc)
 {
-        return gpio_get_value(ADS1672_GPIO_START);
+        return gpio_get_value(gpio_start[adc->index]);
 }
 
-void ads1672_gpio_start_set(int value)
+void ads1672_gpio_start_set(struct ads1672_device * adc, int value)
 {
-        gpio_set_value(ADS1672_GPIO_START, value);
+        gpio_set_value(gpio_start[adc->index], value);
 }
 
-int ads1672_gpio_select_get(void)
+int ads1672_gpio_select_get(struct ads1672_device * adc)
 {
-        return gpio_get_value(ADS1672_GPIO_SELECT);
+        return gpio_get_value(gpio_select[adc->index]);
 }
 
-void ads1672_gpio_select_set(int value)
+void ads1672_gpio_select_set(struct ads1672_device * adc, int value)
 {
-        gpio_set_value(ADS1672_GPIO_SELECT, value);
+        gpio_set_value(gpio_select[adc->index], value);
 }
 
-int ads1672_gpio_init(void)
+int ads1672_gpio_init(struct ads1672_device * adc)
 {
         int r;
+
+        if (!gpio_is_valid(gpio_start[adc->index]) ||
+                        !gpio_is_valid(gpio_select[adc->index])) {
+                printk(KERN_ERR "ads1672.%u: No GPIO pins given\n",
+                                adc->index);
+                return -EINVAL;
+        }
         
-        r = gpio_request_one(ADS1672_GPIO_START, GPIOF_OUT_INIT_LOW, "ADS1672 Start");
-        if (r < 0)
-                return r;
+        if (!start_shared(adc)) {
+                r = gpio_request_one(gpio_start[adc->index],
+                                GPIOF_OUT_INIT_LOW, "ADS1672 Start");
+                if (r < 0)
+                        return r;
+        }
         
-        r = gpio_request_one(ADS1672_GPIO_SELECT, GPIOF_OUT_INIT_HIGH, "ADS1672 Select");
-        if (r < 0)
+        r = gpio_request_one(gpio_select[adc->index], GPIOF_OUT_INIT_HIGH,
+                        "ADS1672 Select");
+        if (r < 0) {
+                if (!start_shared(adc))
+                        gpio_free(gpio_start[adc->index]);
                 return r;
+        }
                 
         return 0;
 }
 
-void ads1672_gpio_exit(void)
+void ads1672_gpio_exit(struct ads1672_device * adc)
 {
-        gpio_free(ADS1672_GPIO_START);
-        gpio_free(ADS1672_GPIO_SELECT);
+        if (!start_shared(adc))
+                gpio_free(gpio_start[adc->index]);
+        gpio_free(gpio_select[adc->index]);
 }
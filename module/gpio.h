@@ -24,38 +24,41 @@
 #ifndef __ADS1672_GPIO_H_INCLUDED__
 #define __ADS1672_GPIO_H_INCLUDED__
 
+struct ads1672_device;
+
 /**
  * Get the status of the start pin. The return value is 1 for a high pin state
  * or 0 for a low pin state.
  */
-int ads1672_gpio_start_get(void);
+int ads1672_gpio_start_get(struct ads1672_device * adc);
 
 /**
  * Set the start pin status to value. A value of 1 means high and a value of 0
  * means low.
  */
-void ads1672_gpio_start_set(int value);
+void ads1672_gpio_start_set(struct ads1672_device * adc, int value);
 
 /**
  * Get the status of the chip select pin. The return value is 1 for a high pin
  * state or 0 for a low pin state.
  */
-int ads1672_gpio_select_get(void);
+int ads1672_gpio_select_get(struct ads1672_device * adc);
 
 /**
  * Set the start pin status to value. A value of 1 means high and a value of 0
  * means low.
  */
-void ads1672_gpio_select_set(int value);
+void ads1672_gpio_select_set(struct ads1672_device * adc, int value);
 
 /**
- * Initialize GPIO pins used by ADS1672 device.
+ * Initialize GPIO pins used by an ADS1672 device, given by its entries in the
+ * gpio_start and gpio_select module parameters.
  */
-int ads1672_gpio_init(void);
+int ads1672_gpio_init(struct ads1672_device * adc);
 
 /**
- * Free GPIO pins used by ADS1672 device.
+ * Free GPIO pins used by an ADS1672 device.
  */
-void ads1672_gpio_exit(void);
+void ads1672_gpio_exit(struct ads1672_device * adc);
 
 #endif /* !__ADS1672_GPIO_H_INCLUDED__ */
@@ -24,17 +24,32 @@
 #ifndef __ADS1672_MCBSP_H_INCLUDED__
 #define __ADS1672_MCBSP_H_INCLUDED__
 
-#include <plat/dma.h>
+#include <linux/types.h>
+
+struct ads1672_device;
 
 /**
  * Start McBSP streaming.
  */
-void ads1672_mcbsp_start(void);
+void ads1672_mcbsp_start(struct ads1672_device * adc);
+
+/**
+ * Start McBSP streaming into user buffers, one period per buffer.
+ *	\param [in] first	DMA address of the first buffer to fill.
+ *	\param [in] second	DMA address of the second buffer to fill.
+ *
+ * Further destinations are obtained from ads1672_ubuf_complete() as each
+ * period completes. The transfer reverts to the kernel buffer on stop.
+ *
+ * \returns 0 on success or a negative error code.
+ */
+int ads1672_mcbsp_start_user(struct ads1672_device * adc, dma_addr_t first,
+		dma_addr_t second);
 
 /**
  * Stop McBSP streaming.
  */
-void ads1672_mcbsp_stop(void);
+void ads1672_mcbsp_stop(struct ads1672_device * adc);
 
 /**
  * Get the current status of the McBSP interface.
@@ -42,16 +57,41 @@ void ads1672_mcbsp_stop(void);
  * \returns A combination of flags from ::ADS1672_STATUS describing the current
  * state.
  */
-int ads1672_mcbsp_status(void);
+int ads1672_mcbsp_status(struct ads1672_device * adc);
+
+/**
+ * Get the address the DMA is currently writing to in the kernel buffer.
+ *
+ * \returns the destination address or 0 if the DMA is not running into the
+ * kernel buffer.
+ */
+dma_addr_t ads1672_mcbsp_get_dst_pos(struct ads1672_device * adc);
+
+/**
+ * Check that a buffer geometry can be handled by the DMA transfer.
+ *
+ * \returns 0 if the geometry is usable or -EINVAL if not.
+ */
+int ads1672_mcbsp_check_geometry(struct ads1672_device * adc,
+		uint period_length, uint nr_periods);
+
+/**
+ * Reprogram the DMA transfer for a newly allocated kernel buffer with the
+ * current geometry of the device.
+ *
+ * \returns 0 on success or -EBUSY if the McBSP interface is running.
+ */
+int ads1672_mcbsp_reconfigure(struct ads1672_device * adc);
 
 /**
- * Initilaize the McBSP interface.
+ * Initilaize the McBSP interface of a device for its kernel buffer. Each
+ * device uses the McBSP port given by its entry in the mcbsp module parameter.
  */
-int ads1672_mcbsp_init(dma_addr_t dma_dest);
+int ads1672_mcbsp_init(struct ads1672_device * adc);
 
 /**
  * Close the McBSP interface.
  */
-void ads1672_mcbsp_exit(void);
+void ads1672_mcbsp_exit(struct ads1672_device * adc);
 
 #endif /* !__ADS1672_MCBSP_H_INCLUDED__ */
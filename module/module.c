@@ -23,77 +23,225 @@
 
 #include <ads1672.h>
 #include <linux/init.h>
+#include <linux/jiffies.h>
 #include <linux/module.h>
 #include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/workqueue.h>
 
 #include "buffer.h"
 #include "device.h"
 #include "gpio.h"
 #include "mcbsp.h"
 #include "module.h"
+#include "ubuf.h"
 
-void ads1672_cleanup(void)
-{
-	/* Delete device objects. */
-	ads1672_device_exit();
+/* Number of ADS1672 devices, each on its own McBSP port. */
+static uint			nr_devices = 1;
+module_param(nr_devices, uint, S_IRUGO);
+
+static struct ads1672_device	devices[ADS1672_MAX_DEVICES];
+
+/* Number of devices fully set up by ads1672_init(). */
+static uint			nr_ready = 0;
 
-	/* Delete hardware interface.*/
-	ads1672_mcbsp_exit();
-	ads1672_gpio_exit();
+/* Has ads1672_device_register() succeeded? */
+static bool			registered = false;
 
-	/* Delete buffering. */
-	ads1672_buf_exit();
+/* The kernel buffer and the hardware interface of each device are only set up
+ * while they are in use, by an open file or a running capture, so that the
+ * memory and DMA channel are free the rest of the time. They are kept for
+ * idle_timeout milliseconds after the last user goes away, so that a new
+ * session started soon after the last one reuses them without the cost of
+ * setting up again.
+ */
+static uint			idle_timeout = 5000;
+module_param(idle_timeout, uint, S_IRUGO | S_IWUSR);
+
+static void teardown(struct ads1672_device * adc)
+{
+	ads1672_mcbsp_exit(adc);
+	ads1672_buf_exit(adc);
+	adc->active = false;
 }
 
-int __init ads1672_init(void)
+static int setup(struct ads1672_device * adc)
 {
 	int r;
-	dma_addr_t dma_addr;
 
-	/* Initialize buffering. */
-	r = ads1672_buf_init();
+	/* The device keeps the geometry of its last session. */
+	r = ads1672_buf_init(adc);
 	if (r < 0) {
-		printk(KERN_ERR "ads1672: Failed to initialize buffering. "
-				"Aborting module init...\n");
-		ads1672_cleanup();
+		printk(KERN_ERR "ads1672.%u: Failed to initialize buffering\n",
+				adc->index);
 		return r;
 	}
 
-	dma_addr = ads1672_buf_get_dma_addr();
-	if (dma_addr == 0) {
-		printk(KERN_ERR "ads1672: Failed to get DMA address of buffer. "
-				"Aborting module init...\n");
-		ads1672_cleanup();
+	if (ads1672_buf_get_dma_addr(adc) == 0) {
+		printk(KERN_ERR "ads1672.%u: Failed to get DMA address of "
+				"buffer\n", adc->index);
+		ads1672_buf_exit(adc);
 		return -EIO;
 	}
-	
-	/* Initialize hardware interface. */
-	r = ads1672_gpio_init();
+
+	r = ads1672_mcbsp_init(adc);
 	if (r < 0) {
-		printk(KERN_ERR "ads1672: Failed to initialize GPIO. "
-				"Aborting module init...\n");
-		ads1672_cleanup();
+		printk(KERN_ERR "ads1672.%u: Failed to initialize McBSP\n",
+				adc->index);
+		teardown(adc);
+		return r;
+	}
+
+	adc->active = true;
+	return 0;
+}
+
+static void idle_work_fn(struct work_struct * work)
+{
+	struct ads1672_device * adc = container_of(to_delayed_work(work),
+			struct ads1672_device, idle_work);
+
+	mutex_lock(&adc->active_lock);
+	if (!adc->active_count && adc->active)
+		teardown(adc);
+	mutex_unlock(&adc->active_lock);
+}
+
+/* Set up everything a device needs for as long as the module is loaded. */
+static int init_device(struct ads1672_device * adc, uint index)
+{
+	int r;
+
+	adc->index = index;
+	adc->period_length = ads1672_period_length;
+	adc->nr_periods = ads1672_nr_periods;
+	mutex_init(&adc->active_lock);
+	INIT_DELAYED_WORK(&adc->idle_work, idle_work_fn);
+
+	/* Initialize hardware interface. The McBSP and DMA are set up on
+	 * first use.
+	 */
+	r = ads1672_gpio_init(adc);
+	if (r < 0) {
+		printk(KERN_ERR "ads1672.%u: Failed to initialize GPIO\n",
+				index);
 		return r;
 	}
-		
-	r = ads1672_mcbsp_init(dma_addr);
+
+	r = ads1672_ubuf_init(adc);
 	if (r < 0) {
-		printk(KERN_ERR "ads1672: Failed to initialize McBSP. "
-				"Aborting module init...\n");
-		ads1672_cleanup();
+		ads1672_gpio_exit(adc);
 		return r;
 	}
 
 	/* Initialize character and platform device objects. */
-	r = ads1672_device_init();
+	r = ads1672_device_init(adc);
+	if (r < 0) {
+		printk(KERN_ERR "ads1672.%u: Failed to initialize device "
+				"objects\n", index);
+		ads1672_ubuf_exit(adc);
+		ads1672_gpio_exit(adc);
+		return r;
+	}
+
+	return 0;
+}
+
+static void exit_device(struct ads1672_device * adc)
+{
+	/* Delete device objects. */
+	ads1672_device_exit(adc);
+
+	/* Delete hardware interface and buffering if still set up. */
+	cancel_delayed_work_sync(&adc->idle_work);
+	if (adc->active)
+		teardown(adc);
+
+	ads1672_ubuf_exit(adc);
+	ads1672_gpio_exit(adc);
+}
+
+int ads1672_get(struct ads1672_device * adc)
+{
+	int r = 0;
+
+	/* Any teardown already under way must finish first. */
+	cancel_delayed_work_sync(&adc->idle_work);
+
+	mutex_lock(&adc->active_lock);
+	if (!adc->active)
+		r = setup(adc);
+	if (r == 0)
+		adc->active_count++;
+	mutex_unlock(&adc->active_lock);
+
+	return r;
+}
+
+void ads1672_put(struct ads1672_device * adc)
+{
+	mutex_lock(&adc->active_lock);
+	if (--adc->active_count == 0)
+		schedule_delayed_work(&adc->idle_work,
+				msecs_to_jiffies(idle_timeout));
+	mutex_unlock(&adc->active_lock);
+}
+
+void ads1672_hold(struct ads1672_device * adc)
+{
+	mutex_lock(&adc->active_lock);
+	WARN_ON(!adc->active_count);
+	adc->active_count++;
+	mutex_unlock(&adc->active_lock);
+}
+
+struct ads1672_device * ads1672_get_device(uint index)
+{
+	if (index >= nr_ready)
+		return NULL;
+	return &devices[index];
+}
+
+void ads1672_cleanup(void)
+{
+	while (nr_ready)
+		exit_device(&devices[--nr_ready]);
+
+	if (registered) {
+		ads1672_device_unregister(nr_devices);
+		registered = false;
+	}
+}
+
+int __init ads1672_init(void)
+{
+	int r;
+
+	if (nr_devices < 1 || nr_devices > ADS1672_MAX_DEVICES) {
+		printk(KERN_ERR "ads1672: nr_devices must be from 1 to %d\n",
+				ADS1672_MAX_DEVICES);
+		return -EINVAL;
+	}
+
+	/* Allocate device numbers and the device class. */
+	r = ads1672_device_register(nr_devices);
 	if (r < 0) {
-		printk(KERN_ERR "ads1672: Failed to initialize device objects. "
+		printk(KERN_ERR "ads1672: Failed to register devices. "
 				"Aborting module init...\n");
-		ads1672_cleanup();
 		return r;
 	}
+	registered = true;
+
+	for (nr_ready = 0; nr_ready < nr_devices; nr_ready++) {
+		r = init_device(&devices[nr_ready], nr_ready);
+		if (r < 0) {
+			printk(KERN_ERR "ads1672: Aborting module init...\n");
+			ads1672_cleanup();
+			return r;
+		}
+	}
 
-	printk(KERN_ALERT "ads1672: Loaded\n");
+	printk(KERN_ALERT "ads1672: Loaded %u devices\n", nr_devices);
 	return 0;
 }
 
@@ -24,6 +24,38 @@
 #ifndef __ADS1672_MODULE_H_INCLUDED__
 #define __ADS1672_MODULE_H_INCLUDED__
 
+#include <linux/types.h>
+
+struct ads1672_device;
+
+/**
+ * Take a reference on the kernel buffer and hardware interface of a device,
+ * setting them up if they are not already.
+ *
+ * \returns 0 on success or <0 on error.
+ */
+int ads1672_get(struct ads1672_device * adc);
+
+/**
+ * Drop a reference taken by ads1672_get(). The buffer and hardware interface
+ * are torn down once they have had no users for idle_timeout milliseconds.
+ */
+void ads1672_put(struct ads1672_device * adc);
+
+/**
+ * Take a further reference on a device which is already in use, as when a
+ * mapping of its buffer is copied. The caller must already hold a reference, so
+ * nothing needs to be set up and this cannot fail.
+ */
+void ads1672_hold(struct ads1672_device * adc);
+
+/**
+ * Get a device by its index.
+ *
+ * \returns the device or NULL if there is no device with that index.
+ */
+struct ads1672_device * ads1672_get_device(uint index);
+
 /**
  * Module cleanup - usable in either init or exit sections.
  */
@@ -0,0 +1,339 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * trigger.c
+ * Timed start of capture on an ADS1672 device.
+ */
+
+#include <ads1672.h>
+#include <linux/completion.h>
+#include <linux/hrtimer.h>
+#include <linux/irqflags.h>
+#include <linux/kernel.h>
+#include <linux/ktime.h>
+#include <linux/moduleparam.h>
+#include <linux/mutex.h>
+#include <linux/time.h>
+
+#include "buffer.h"
+#include "device.h"
+#include "gpio.h"
+#include "mcbsp.h"
+#include "module.h"
+#include "trigger.h"
+#include "ubuf.h"
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Time in nanoseconds from the rising edge of START to the first sample. This
+ * is set by the master clock and digital filter of the converter, see its data
+ * sheet, plus any delay on the board. With 0 the edge itself is taken as the
+ * time of the first sample.
+ */
+static uint			start_delay = 0;
+module_param(start_delay, uint, S_IRUGO | S_IWUSR);
+
+/* Time in nanoseconds by which the timer of a scheduled start fires early. The
+ * rest of the wait is spent polling the clock, which takes out the latency of
+ * the timer interrupt at the cost of keeping the CPU busy with interrupts
+ * disabled for that long, so it is limited to MAX_TRIGGER_LEAD.
+ */
+static uint			trigger_lead = 0;
+
+#define MAX_TRIGGER_LEAD	100000
+
+static int set_trigger_lead(const char * val, const struct kernel_param * kp)
+{
+	uint lead;
+	int r;
+
+	r = kstrtouint(val, 0, &lead);
+	if (r < 0)
+		return r;
+	if (lead > MAX_TRIGGER_LEAD)
+		return -EINVAL;
+
+	return param_set_uint(val, kp);
+}
+
+static const struct kernel_param_ops trigger_lead_ops = {
+	.set	= set_trigger_lead,
+	.get	= param_get_uint,
+};
+module_param_cb(trigger_lead, &trigger_lead_ops, &trigger_lead,
+		S_IRUGO | S_IWUSR);
+
+/* A start scheduled by ads1672_trigger_start_at(). */
+struct ads1672_scheduled_start {
+	struct hrtimer			timer;
+	struct ads1672_device *		adc;
+	clockid_t			clock;
+
+	/* Requested time of the edge, and when it was actually raised, on
+	 * the requested clock.
+	 */
+	ktime_t				when;
+	ktime_t				actual;
+
+	/* Value of trigger_lead when the timer was started. */
+	uint				lead;
+
+	struct ads1672_trigger *	t;
+	struct completion		done;
+
+	/* Set by ads1672_trigger_cancel() if the device was stopped before the
+	 * timer fired.
+	 */
+	bool				cancelled;
+};
+
+/* Arm the transfer of a stopped device with START held low, so that no sample
+ * is taken until it is raised. Called with start_lock held.
+ */
+static int arm(struct ads1672_device * adc, uint * seq)
+{
+	int r;
+
+	if ((ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING) ||
+			ads1672_ubuf_active(adc))
+		return -EBUSY;
+
+	if (!adc->running_ref) {
+		r = ads1672_get(adc);
+		if (r < 0)
+			return r;
+		adc->running_ref = true;
+	}
+
+	ads1672_gpio_start_set(adc, 0);
+	ads1672_mcbsp_start(adc);
+
+	if (!(ads1672_mcbsp_status(adc) & ADS1672_STATUS_RUNNING)) {
+		adc->running_ref = false;
+		ads1672_put(adc);
+		return -EIO;
+	}
+
+	/* Nothing can complete before START is raised, so this is the first
+	 * period of the capture.
+	 */
+	*seq = ads1672_buf_get_write_seq(adc);
+	return 0;
+}
+
+/* Raise START between two reads of the clock. Interrupts are disabled so that
+ * the window is only as wide as the pin write itself.
+ */
+static void fire(struct ads1672_device * adc, struct ads1672_trigger * t)
+{
+	struct timespec64 before, after;
+	unsigned long flags;
+	s64 ns;
+
+	local_irq_save(flags);
+	ktime_get_raw_ts64(&before);
+	ads1672_gpio_start_set(adc, 1);
+	ktime_get_raw_ts64(&after);
+	local_irq_restore(flags);
+
+	ns = timespec64_to_ns(&before);
+	t->window = (uint) (timespec64_to_ns(&after) - ns);
+	ns += t->window / 2;
+
+	ads1672_buf_ns_to_ts(ns, &t->start);
+	ads1672_buf_ns_to_ts(ns + start_delay, &t->first);
+}
+
+/* Undo arm() if START is never raised. Called with start_lock held. */
+static void disarm(struct ads1672_device * adc)
+{
+	ads1672_mcbsp_stop(adc);
+	adc->running_ref = false;
+	ads1672_put(adc);
+}
+
+static ktime_t read_clock(clockid_t clock)
+{
+	return clock == CLOCK_TAI ? ktime_get_clocktai() : ktime_get_real();
+}
+
+/* Raise START for a scheduled start. This runs in hard interrupt context. */
+static enum hrtimer_restart scheduled_start_fn(struct hrtimer * timer)
+{
+	struct ads1672_scheduled_start * s = container_of(timer,
+			struct ads1672_scheduled_start, timer);
+	s64 when = ktime_to_ns(s->when);
+	s64 limit, before, after;
+
+	/* Poll out whatever is left of the wait, see trigger_lead. If the
+	 * clock is stepped back meanwhile the edge could be a long way off, so
+	 * give up once twice the lead has passed on the raw clock and raise it
+	 * anyway. The error reported to the caller shows how far out it was.
+	 */
+	limit = ktime_to_ns(ktime_get_raw()) + 2 * (s64) s->lead;
+	for (;;) {
+		before = ktime_to_ns(read_clock(s->clock));
+		if (before >= when || ktime_to_ns(ktime_get_raw()) >= limit)
+			break;
+		cpu_relax();
+	}
+
+	fire(s->adc, s->t);
+	after = ktime_to_ns(read_clock(s->clock));
+
+	s->actual = ns_to_ktime(before + (after - before) / 2);
+	complete(&s->done);
+	return HRTIMER_NORESTART;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+int ads1672_trigger_start(struct ads1672_device * adc,
+		struct ads1672_reader * reader, struct ads1672_trigger * t)
+{
+	int r;
+
+	mutex_lock(&adc->start_lock);
+
+	r = arm(adc, &t->seq);
+	if (r < 0)
+		goto out;
+
+	/* The next read returns the first sample. */
+	if (reader) {
+		r = ads1672_buf_seek(reader, t->seq);
+		if (r < 0) {
+			disarm(adc);
+			goto out;
+		}
+	}
+
+	fire(adc, t);
+	ads1672_buf_set_start(adc, t->seq, &t->first);
+
+out:
+	mutex_unlock(&adc->start_lock);
+	return r;
+}
+
+int ads1672_trigger_start_at(struct ads1672_device * adc,
+		struct ads1672_reader * reader, struct ads1672_trigger_at * req)
+{
+	struct ads1672_scheduled_start s;
+	int r;
+
+	if ((req->clock != CLOCK_REALTIME && req->clock != CLOCK_TAI) ||
+			req->when.tv_sec < 0 || req->when.tv_nsec < 0 ||
+			req->when.tv_nsec >= NSEC_PER_SEC)
+		return -EINVAL;
+
+	s.adc = adc;
+	s.clock = req->clock;
+	s.when = ktime_set(req->when.tv_sec, req->when.tv_nsec);
+	s.lead = READ_ONCE(trigger_lead);
+	s.t = &req->trigger;
+	s.cancelled = false;
+	init_completion(&s.done);
+
+	mutex_lock(&adc->start_lock);
+
+	r = arm(adc, &req->trigger.seq);
+	if (r < 0)
+		goto out;
+
+	/* As for ads1672_trigger_start(). */
+	if (reader) {
+		r = ads1672_buf_seek(reader, req->trigger.seq);
+		if (r < 0) {
+			disarm(adc);
+			goto out;
+		}
+	}
+
+	hrtimer_init_on_stack(&s.timer, s.clock, HRTIMER_MODE_ABS);
+	s.timer.function = scheduled_start_fn;
+	hrtimer_start(&s.timer, ktime_sub_ns(s.when, s.lead),
+			HRTIMER_MODE_ABS);
+
+	/* Don't hold the lock while waiting for the edge, which may be a long
+	 * way off. The device stays running meanwhile, so anyone else starting
+	 * it gets -EBUSY, and a stop cancels the timer through adc->scheduled.
+	 */
+	adc->scheduled = &s;
+	mutex_unlock(&adc->start_lock);
+
+	r = wait_for_completion_interruptible(&s.done);
+
+	mutex_lock(&adc->start_lock);
+
+	if (adc->scheduled == &s)
+		adc->scheduled = NULL;
+
+	/* Give up on a signal unless the timer has already fired. Cancelling
+	 * waits for a callback which is running, so if the timer was no longer
+	 * active START has been raised. A stop has already disarmed the
+	 * transfer. The timer is cancelled in any case so that its callback
+	 * has returned before it is destroyed.
+	 */
+	if (s.cancelled) {
+		r = -ECANCELED;
+	} else if (r < 0) {
+		if (hrtimer_cancel(&s.timer)) {
+			disarm(adc);
+			r = -EINTR;
+		} else {
+			r = 0;
+		}
+	}
+	hrtimer_cancel(&s.timer);
+	destroy_hrtimer_on_stack(&s.timer);
+	if (r < 0)
+		goto out;
+
+	ads1672_buf_set_start(adc, req->trigger.seq, &req->trigger.first);
+
+	ads1672_buf_ns_to_ts(ktime_to_ns(s.actual), &req->actual);
+	req->error = ktime_to_ns(ktime_sub(s.actual, s.when));
+
+out:
+	mutex_unlock(&adc->start_lock);
+	return r;
+}
+
+void ads1672_trigger_cancel(struct ads1672_device * adc)
+{
+	struct ads1672_scheduled_start * s = adc->scheduled;
+
+	if (!s)
+		return;
+
+	adc->scheduled = NULL;
+
+	/* If the timer has fired START is up, and the stop goes ahead as for
+	 * any running capture.
+	 */
+	if (hrtimer_cancel(&s->timer)) {
+		s->cancelled = true;
+		complete(&s->done);
+	}
+}
@@ -0,0 +1,73 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/**
+ * \file trigger.h
+ * Timed start of capture on an ADS1672 device.
+ */
+
+#ifndef __ADS1672_TRIGGER_H_INCLUDED__
+#define __ADS1672_TRIGGER_H_INCLUDED__
+
+struct ads1672_device;
+struct ads1672_reader;
+struct ads1672_trigger;
+struct ads1672_trigger_at;
+
+/**
+ * Arm the transfer of a stopped device with START held low, then raise START
+ * and record when it was raised.
+ *	\param [in] reader	Reader to move to the first period of the capture
+ *				before START is raised, or NULL.
+ *	\param [out] t	The first period of the capture and its timing.
+ *
+ * \returns 0 on success, -EBUSY if the device is running or has user buffers
+ * registered, the error from ads1672_buf_seek() if the reader cannot be moved,
+ * or <0 on any other error. The transfer is left disarmed on error.
+ */
+int ads1672_trigger_start(struct ads1672_device * adc,
+		struct ads1672_reader * reader, struct ads1672_trigger * t);
+
+/**
+ * As ads1672_trigger_start(), but raise START from a high resolution timer at
+ * an absolute time.
+ *	\param [in] reader	Reader to move to the first period of the capture
+ *				before the timer is started, or NULL.
+ *	\param [in,out] req	The requested clock and time, filled in with the
+ *				actual time and the result.
+ *
+ * The device's start_lock is only held while arming, so the device can be
+ * stopped while the timer is pending, which cancels the start.
+ *
+ * \returns 0 once START has been raised, -EINTR if interrupted by a signal
+ * before then, -ECANCELED if the device was stopped before then, the error
+ * from ads1672_buf_seek() if the reader cannot be moved, or <0 on any other
+ * error. The transfer is left disarmed on error.
+ */
+int ads1672_trigger_start_at(struct ads1672_device * adc,
+		struct ads1672_reader * reader, struct ads1672_trigger_at * req);
+
+/**
+ * Cancel a start scheduled by ads1672_trigger_start_at() if its timer has not
+ * fired, and wake the caller waiting for it. The transfer is left armed for
+ * the caller of this function to stop. Called with the device's start_lock
+ * held.
+ */
+void ads1672_trigger_cancel(struct ads1672_device * adc);
+
+#endif /* !__ADS1672_TRIGGER_H_INCLUDED__ */
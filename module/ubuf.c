@@ -0,0 +1,501 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/*
+ * ubuf.c
+ * Direct DMA into user buffers for ads1672 driver.
+ */
+
+#include <ads1672.h>
+#include <linux/dma-mapping.h>
+#include <linux/kernel.h>
+#include <linux/list.h>
+#include <linux/mm.h>
+#include <linux/mutex.h>
+#include <linux/pagemap.h>
+#include <linux/sched.h>
+#include <linux/slab.h>
+#include <linux/spinlock.h>
+#include <linux/wait.h>
+
+#include "buffer.h"
+#include "device.h"
+#include "ubuf.h"
+
+/*******************************************************************************
+	Private declarations and functions
+*******************************************************************************/
+
+/* Where a user buffer is. Buffers move from the user to the queue, from the
+ * queue to the DMA, from the DMA to the done list and from there back to the
+ * user.
+ */
+enum UBUF_STATE {
+	UBUF_USER = 0,
+	UBUF_QUEUED,
+	UBUF_DMA,
+	UBUF_DONE
+};
+
+struct ubuf {
+	void __user *			addr;
+	size_t				length;
+	struct page **			pages;
+	uint				nr_pages;
+	dma_addr_t			dma;
+	int				state;
+	struct ads1672_period_status	status;
+	struct list_head		list;
+};
+
+/* User buffers of one device. */
+struct ads1672_ubuf {
+	struct ads1672_device *		adc;
+
+	struct ubuf			ubufs[ADS1672_MAX_USER_BUFFERS];
+	uint				nr_ubufs;
+
+	/* The file which registered the buffers, only it may use them. */
+	struct file *			owner;
+
+	/* Serialises registration and release of buffers, which may sleep. */
+	struct mutex			ubuf_lock;
+
+	/* Protects the queues and the buffers given to the DMA against the
+	 * DMA callback.
+	 */
+	spinlock_t			queue_lock;
+	struct list_head		queued;
+	struct list_head		done;
+
+	/* The buffer the DMA is filling and the one it will fill next. NULL
+	 * means the scratch destination, used when the queue has run dry.
+	 */
+	struct ubuf *			filling;
+	struct ubuf *			next;
+	dma_addr_t			scratch;
+
+	/* Number of periods completed since capture started. */
+	uint				seq;
+
+	/* Set when a period was discarded into the scratch destination. */
+	bool				lost;
+
+	wait_queue_head_t		done_wait;
+};
+
+static size_t period_bytes(struct ads1672_ubuf * u)
+{
+	return u->adc->period_length * sizeof(ads1672_sample_t);
+}
+
+static struct device * dma_dev(struct ads1672_ubuf * u)
+{
+	return &u->adc->plat.dev;
+}
+
+static void unpin(struct ads1672_ubuf * u, struct ubuf * ub)
+{
+	dma_unmap_page(dma_dev(u), ub->dma, ub->length, DMA_FROM_DEVICE);
+
+	/* The DMA wrote to the pages behind the back of the page tables. */
+	unpin_user_pages_dirty_lock(ub->pages, ub->nr_pages, true);
+
+	kfree(ub->pages);
+	ub->pages = NULL;
+	ub->nr_pages = 0;
+}
+
+/* Pin a user buffer and map it for the DMA. The DMA has a single destination
+ * address per period, so the buffer must be physically contiguous. The pages
+ * stay pinned for as long as the buffer is registered, so they are pinned
+ * long term, which keeps them out of movable memory.
+ */
+static int pin(struct ads1672_ubuf * u, struct ubuf * ub, void __user * addr,
+		size_t length)
+{
+	unsigned long pfn;
+	int nr_pages;
+	int r;
+	int i;
+
+	if ((unsigned long) addr & ~PAGE_MASK || length != period_bytes(u))
+		return -EINVAL;
+
+	nr_pages = PAGE_ALIGN(length) >> PAGE_SHIFT;
+	ub->pages = kmalloc_array(nr_pages, sizeof(*ub->pages), GFP_KERNEL);
+	if (!ub->pages)
+		return -ENOMEM;
+
+	r = pin_user_pages_fast((unsigned long) addr, nr_pages,
+			FOLL_WRITE | FOLL_LONGTERM, ub->pages);
+	if (r < 0)
+		goto err_free;
+	ub->nr_pages = r;
+	if (r < nr_pages) {
+		r = -EFAULT;
+		goto err_put;
+	}
+
+	pfn = page_to_pfn(ub->pages[0]);
+	for (i = 1; i < nr_pages; i++) {
+		if (page_to_pfn(ub->pages[i]) != pfn + i) {
+			r = -EINVAL;
+			goto err_put;
+		}
+	}
+
+	ub->dma = dma_map_page(dma_dev(u), ub->pages[0], 0, length,
+			DMA_FROM_DEVICE);
+	if (dma_mapping_error(dma_dev(u), ub->dma)) {
+		r = -ENOMEM;
+		goto err_put;
+	}
+
+	ub->addr = addr;
+	ub->length = length;
+	ub->state = UBUF_USER;
+	return 0;
+
+err_put:
+	unpin_user_pages(ub->pages, ub->nr_pages);
+err_free:
+	kfree(ub->pages);
+	ub->pages = NULL;
+	ub->nr_pages = 0;
+	return r;
+}
+
+/* Take the next queued buffer for the DMA, or NULL if there is none. Called
+ * with queue_lock held.
+ */
+static struct ubuf * take_queued(struct ads1672_ubuf * u)
+{
+	struct ubuf * ub;
+
+	if (list_empty(&u->queued))
+		return NULL;
+
+	ub = list_first_entry(&u->queued, struct ubuf, list);
+	list_del(&ub->list);
+	ub->state = UBUF_DMA;
+	return ub;
+}
+
+static dma_addr_t dest(struct ads1672_ubuf * u, struct ubuf * ub)
+{
+	return ub ? ub->dma : u->scratch;
+}
+
+/*******************************************************************************
+	Public functions
+*******************************************************************************/
+
+int ads1672_ubuf_queue(struct ads1672_device * adc, struct file * f,
+		struct ads1672_user_buffer * buf)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+	struct ubuf * ub = NULL;
+	unsigned long flags;
+	uint i;
+	int r = 0;
+
+	mutex_lock(&u->ubuf_lock);
+
+	if (u->owner && u->owner != f) {
+		r = -EBUSY;
+		goto out;
+	}
+
+	for (i = 0; i < u->nr_ubufs; i++) {
+		if (u->ubufs[i].addr == u64_to_user_ptr(buf->addr)) {
+			ub = &u->ubufs[i];
+			break;
+		}
+	}
+
+	if (ub) {
+		if (ub->state != UBUF_USER) {
+			r = -EBUSY;
+			goto out;
+		}
+
+		/* Hand the buffer back from the CPU to the device. */
+		dma_sync_single_for_device(dma_dev(u), ub->dma, ub->length,
+				DMA_FROM_DEVICE);
+	} else {
+		if (u->nr_ubufs == ADS1672_MAX_USER_BUFFERS) {
+			r = -ENOSPC;
+			goto out;
+		}
+
+		ub = &u->ubufs[u->nr_ubufs];
+		r = pin(u, ub, u64_to_user_ptr(buf->addr), buf->length);
+		if (r < 0)
+			goto out;
+
+		i = u->nr_ubufs++;
+		u->owner = f;
+	}
+
+	spin_lock_irqsave(&u->queue_lock, flags);
+	ub->state = UBUF_QUEUED;
+	list_add_tail(&ub->list, &u->queued);
+	spin_unlock_irqrestore(&u->queue_lock, flags);
+
+	buf->index = i;
+
+out:
+	mutex_unlock(&u->ubuf_lock);
+	return r;
+}
+
+int ads1672_ubuf_dequeue(struct ads1672_device * adc, struct file * f,
+		struct ads1672_user_buffer * buf, bool nonblock)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+	struct ubuf * ub = NULL;
+	unsigned long flags;
+	int r;
+
+	if (u->owner != f)
+		return -EINVAL;
+
+	for (;;) {
+		if (list_empty(&u->done)) {
+			if (nonblock)
+				return -EAGAIN;
+
+			r = wait_event_interruptible(u->done_wait,
+					!list_empty(&u->done) || u->owner != f);
+			if (r < 0)
+				return r;
+		}
+
+		mutex_lock(&u->ubuf_lock);
+		if (u->owner != f) {
+			mutex_unlock(&u->ubuf_lock);
+			return -EINVAL;
+		}
+
+		spin_lock_irqsave(&u->queue_lock, flags);
+		if (!list_empty(&u->done)) {
+			ub = list_first_entry(&u->done, struct ubuf, list);
+			list_del(&ub->list);
+			ub->state = UBUF_USER;
+		}
+		spin_unlock_irqrestore(&u->queue_lock, flags);
+
+		if (ub)
+			break;
+
+		/* Someone else took it, wait again. */
+		mutex_unlock(&u->ubuf_lock);
+	}
+
+	/* Make the samples written by the DMA visible to the CPU. */
+	dma_sync_single_for_cpu(dma_dev(u), ub->dma, ub->length,
+			DMA_FROM_DEVICE);
+
+	buf->addr = (uintptr_t) ub->addr;
+	buf->length = ub->length;
+	buf->index = ub - u->ubufs;
+	buf->status = ub->status;
+
+	mutex_unlock(&u->ubuf_lock);
+	return 0;
+}
+
+int ads1672_ubuf_release(struct ads1672_device * adc, struct file * f)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+	uint i;
+	int r = 0;
+
+	mutex_lock(&u->ubuf_lock);
+
+	if (u->owner != f) {
+		r = u->owner ? -EBUSY : 0;
+		goto out;
+	}
+
+	for (i = 0; i < u->nr_ubufs; i++)
+		unpin(u, &u->ubufs[i]);
+
+	u->nr_ubufs = 0;
+	INIT_LIST_HEAD(&u->queued);
+	INIT_LIST_HEAD(&u->done);
+	u->filling = NULL;
+	u->next = NULL;
+	u->owner = NULL;
+
+	wake_up_interruptible(&u->done_wait);
+
+out:
+	mutex_unlock(&u->ubuf_lock);
+	return r;
+}
+
+unsigned int ads1672_ubuf_poll(struct ads1672_device * adc, struct file * f,
+		poll_table * wait)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+
+	poll_wait(f, &u->done_wait, wait);
+
+	if (u->owner == f && !list_empty(&u->done))
+		return POLLIN | POLLRDNORM;
+
+	return 0;
+}
+
+bool ads1672_ubuf_active(struct ads1672_device * adc)
+{
+	return adc->ubuf->nr_ubufs != 0;
+}
+
+bool ads1672_ubuf_is_owner(struct ads1672_device * adc, struct file * f)
+{
+	return adc->ubuf->owner == f;
+}
+
+int ads1672_ubuf_prepare(struct ads1672_device * adc, dma_addr_t * first,
+		dma_addr_t * second)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+	unsigned long flags;
+	int r = 0;
+
+	spin_lock_irqsave(&u->queue_lock, flags);
+
+	if (list_empty(&u->queued)) {
+		r = -ENOBUFS;
+		goto out;
+	}
+
+	/* Periods for which no buffer is queued are discarded into the kernel
+	 * buffer, which is otherwise unused while capturing into user buffers.
+	 */
+	u->scratch = ads1672_buf_get_dma_addr(adc);
+	u->seq = 0;
+	u->lost = false;
+
+	u->filling = take_queued(u);
+	u->next = take_queued(u);
+
+	*first = dest(u, u->filling);
+	*second = dest(u, u->next);
+
+out:
+	spin_unlock_irqrestore(&u->queue_lock, flags);
+	return r;
+}
+
+dma_addr_t ads1672_ubuf_complete(struct ads1672_device * adc, int cond,
+		uint nr_samples, const struct timespec64 * end)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+	struct ubuf * ub;
+	dma_addr_t r;
+
+	spin_lock(&u->queue_lock);
+
+	ub = u->filling;
+	if (ub) {
+		/* Report any periods discarded since the last buffer. */
+		ub->status.cond = (u->lost && cond == ADS1672_COND_OK) ?
+			ADS1672_COND_OVERRUN : cond;
+		ub->status.nr_samples = nr_samples;
+		ub->status.nr_lost = 0;
+		ub->status.seq = u->seq;
+		ads1672_buf_ns_to_ts(timespec64_to_ns(end) -
+				ads1672_buf_samples_to_ns(nr_samples),
+				&ub->status.ts);
+		u->lost = false;
+
+		ub->state = UBUF_DONE;
+		list_add_tail(&ub->list, &u->done);
+	} else {
+		u->lost = true;
+	}
+	u->seq++;
+
+	/* The DMA has already moved on to the next destination, so queue up
+	 * the one after it.
+	 */
+	u->filling = u->next;
+	u->next = take_queued(u);
+	r = dest(u, u->next);
+
+	spin_unlock(&u->queue_lock);
+
+	if (ub)
+		wake_up_interruptible(&u->done_wait);
+
+	return r;
+}
+
+void ads1672_ubuf_stop(struct ads1672_device * adc)
+{
+	struct ads1672_ubuf * u = adc->ubuf;
+	unsigned long flags;
+
+	spin_lock_irqsave(&u->queue_lock, flags);
+
+	/* Return the buffers to the front of the queue in their original
+	 * order.
+	 */
+	if (u->next) {
+		u->next->state = UBUF_QUEUED;
+		list_add(&u->next->list, &u->queued);
+		u->next = NULL;
+	}
+	if (u->filling) {
+		u->filling->state = UBUF_QUEUED;
+		list_add(&u->filling->list, &u->queued);
+		u->filling = NULL;
+	}
+
+	spin_unlock_irqrestore(&u->queue_lock, flags);
+}
+
+int ads1672_ubuf_init(struct ads1672_device * adc)
+{
+	struct ads1672_ubuf * u;
+
+	u = kzalloc(sizeof(*u), GFP_KERNEL);
+	if (!u)
+		return -ENOMEM;
+
+	u->adc = adc;
+	mutex_init(&u->ubuf_lock);
+	spin_lock_init(&u->queue_lock);
+	INIT_LIST_HEAD(&u->queued);
+	INIT_LIST_HEAD(&u->done);
+	init_waitqueue_head(&u->done_wait);
+
+	adc->ubuf = u;
+	return 0;
+}
+
+void ads1672_ubuf_exit(struct ads1672_device * adc)
+{
+	/* Every file has been closed, so every buffer has been released. */
+	kfree(adc->ubuf);
+	adc->ubuf = NULL;
+}
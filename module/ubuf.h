@@ -0,0 +1,128 @@
+/*
+ * Copyright (C) 2011-2013 Paul Barker, Loughborough University
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program; if not, write to the Free Software
+ * Foundation, Inc., 59 Temple Place, Suite 330, Boston, MA 02111-1307 USA
+ */
+
+/**
+ * \file ubuf.h
+ * Direct DMA into user buffers for ads1672 driver.
+ */
+
+#ifndef __ADS1672_UBUF_H_INCLUDED__
+#define __ADS1672_UBUF_H_INCLUDED__
+
+#include <ads1672.h>
+#include <linux/fs.h>
+#include <linux/poll.h>
+#include <linux/time.h>
+#include <linux/types.h>
+
+struct ads1672_device;
+
+/**
+ * Maximum number of user buffers which may be registered.
+ */
+#define ADS1672_MAX_USER_BUFFERS	32
+
+/**
+ * Queue a user buffer for the DMA, pinning and registering it on first use.
+ *	\param [in] adc	The device the buffer is for.
+ *	\param [in] owner	The file queuing the buffer.
+ *	\param [in,out] buf	The buffer, index is filled in on return.
+ *
+ * \returns 0 on success or <0 on error.
+ */
+int ads1672_ubuf_queue(struct ads1672_device * adc, struct file * owner,
+		struct ads1672_user_buffer * buf);
+
+/**
+ * Take the oldest filled user buffer.
+ *	\param [in] adc	The device the buffer is from.
+ *	\param [in] owner	The file which registered the buffers.
+ *	\param [out] buf	Filled in with the buffer and its status.
+ *	\param [in] nonblock	Fail with -EAGAIN rather than waiting.
+ *
+ * \returns 0 on success or <0 on error.
+ */
+int ads1672_ubuf_dequeue(struct ads1672_device * adc, struct file * owner,
+		struct ads1672_user_buffer * buf, bool nonblock);
+
+/**
+ * Unpin and forget all user buffers registered by a file. The DMA must not be
+ * running into them.
+ *
+ * \returns 0 on success or -EBUSY if the buffers belong to another file.
+ */
+int ads1672_ubuf_release(struct ads1672_device * adc, struct file * owner);
+
+/**
+ * Poll for filled user buffers.
+ *
+ * \returns POLLIN | POLLRDNORM if owner has a filled buffer ready.
+ */
+unsigned int ads1672_ubuf_poll(struct ads1672_device * adc,
+		struct file * owner, poll_table * wait);
+
+/**
+ * Are user buffers registered, so that capture should go into them?
+ */
+bool ads1672_ubuf_active(struct ads1672_device * adc);
+
+/**
+ * Does this file own the registered user buffers?
+ */
+bool ads1672_ubuf_is_owner(struct ads1672_device * adc, struct file * f);
+
+/**
+ * Take the first two DMA destinations from the queue when starting capture.
+ *	\param [out] first	Destination of the first period.
+ *	\param [out] second	Destination of the second period.
+ *
+ * \returns 0 on success or -ENOBUFS if no buffer is queued.
+ */
+int ads1672_ubuf_prepare(struct ads1672_device * adc, dma_addr_t * first,
+		dma_addr_t * second);
+
+/**
+ * Complete the user buffer being filled and choose the destination which
+ * follows the one now being filled. Called from the DMA callback.
+ *	\param [in] adc	The device whose period completed.
+ *	\param [in] cond	Condition code of the period.
+ *	\param [in] nr_samples	Number of valid samples in the period.
+ *	\param [in] end	CLOCK_MONOTONIC_RAW time at which the period ended.
+ *
+ * \returns the DMA address to program as the next destination.
+ */
+dma_addr_t ads1672_ubuf_complete(struct ads1672_device * adc, int cond,
+		uint nr_samples, const struct timespec64 * end);
+
+/**
+ * Return the buffers the DMA was filling to the front of the queue once
+ * capture has stopped. Their contents are discarded.
+ */
+void ads1672_ubuf_stop(struct ads1672_device * adc);
+
+/**
+ * Set up the user buffer state of a device.
+ */
+int ads1672_ubuf_init(struct ads1672_device * adc);
+
+/**
+ * Free the user buffer state of a device.
+ */
+void ads1672_ubuf_exit(struct ads1672_device * adc);
+
+#endif /* !__ADS1672_UBUF_H_INCLUDED__ */